@@ -3,6 +3,7 @@
 use Getopt::Std;
 use FileHandle;
 use IPC::Open2;
+use Time::HiRes;
 
 #######################################################################
 # sdriver.pl - Shell driver
@@ -33,6 +34,7 @@ use IPC::Open2;
 #     CLOSE       Close Writer (sends EOF signal to child)
 #     WAIT        Wait() for child to terminate
 #     SLEEP <n>   Sleep for <n> seconds
+#     MSLEEP <n>  Sleep for <n> milliseconds
 #
 ######################################################################
 
@@ -171,6 +173,14 @@ while (<INFILE>) {
 	}
     }
 
+    # Sleep in milliseconds
+    elsif ($line =~ /MSLEEP (\d+)/) {
+	if ($verbose) {
+	    print "$0: Sleeping $1 msecs\n";
+	}
+	Time::HiRes::sleep($1 / 1000);
+    }
+
     # Sleep
     elsif ($line =~ /SLEEP (\d+)/) {
 	if ($verbose) {
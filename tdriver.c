@@ -0,0 +1,526 @@
+/*
+ * tdriver.c - Native trace driver for the tiny shell
+ *
+ * usage: tdriver [-hv] [-j <n>] [-s <shell>] [-a <args>] [-o <ref>] trace...
+ *
+ * Replays trace files against a shell the same way sdriver.pl does,
+ * but runs up to <n> traces at once, each in its own process group,
+ * and can check the results against a reference output file such as
+ * tshref.out. PIDs are masked and /bin/ps listings are skipped when
+ * comparing.
+ *
+ * Driver commands (in addition to shell commands and # comments):
+ *     TSTP        Send a SIGTSTP signal to the shell
+ *     INT         Send a SIGINT signal to the shell
+ *     QUIT        Send a SIGQUIT signal to the shell
+ *     KILL        Send a SIGKILL signal to the shell
+ *     CLOSE       Close the shell's stdin (sends EOF)
+ *     WAIT        Wait for the shell to terminate
+ *     SLEEP <n>   Sleep for <n> seconds (fractions allowed)
+ *     MSLEEP <n>  Sleep for <n> milliseconds
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXLINE  1024   /* max line size */
+#define MAXARGS   128   /* max args for the shell */
+#define MAXRUNS   256   /* max traces on the command line */
+
+struct buf_t {          /* growable output buffer */
+    char *data;
+    size_t len, cap;
+};
+
+struct run_t {          /* one trace replay */
+    const char *trace;  /* trace file */
+    pid_t pid;          /* worker process, 0 if not started or done */
+    int fd;             /* read end of the worker's result pipe */
+    struct buf_t out;   /* everything the worker reported */
+    double start, ms;   /* start time and elapsed milliseconds */
+    int status;         /* worker exit status */
+};
+
+char *shellargv[MAXARGS];  /* shell program and its arguments */
+int verbose = 0;           /* print the output of every trace */
+
+/*
+ * now_ms - Milliseconds on the monotonic clock
+ */
+double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*
+ * append - Add len bytes to a buffer
+ */
+void append(struct buf_t *b, const char *data, size_t len)
+{
+    if (b->len + len > b->cap) {
+	while (b->len + len > b->cap)
+	    b->cap = b->cap ? b->cap * 2 : 4096;
+	if ((b->data = realloc(b->data, b->cap)) == NULL) {
+	    perror("realloc");
+	    exit(2);
+	}
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+}
+
+/*
+ * drain - Read shell output into b for up to ms milliseconds, or until
+ *     EOF if ms is negative. Return 0 once the pipe reaches EOF.
+ */
+int drain(int fd, struct buf_t *b, double ms)
+{
+    char chunk[4096];
+    double deadline = now_ms() + ms;
+    struct pollfd pfd;
+    int n, wait;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+	wait = (ms < 0) ? -1 : (int)(deadline - now_ms() + 0.5);
+	if (ms >= 0 && wait <= 0)
+	    return 1;
+	if ((n = poll(&pfd, 1, wait)) < 0 && errno != EINTR) {
+	    perror("poll");
+	    exit(2);
+	}
+	if (n <= 0)
+	    continue;
+	if ((n = read(fd, chunk, sizeof(chunk))) < 0 && errno != EINTR) {
+	    perror("read");
+	    exit(2);
+	}
+	if (n == 0)
+	    return 0;
+	if (n > 0)
+	    append(b, chunk, n);
+    }
+}
+
+/*
+ * replay - Run one trace against a fresh shell and write what
+ *     sdriver.pl would have printed to outfd. Runs in a worker process.
+ */
+void replay(const char *trace, int outfd)
+{
+    char line[MAXLINE], word[MAXLINE], *p, *end;
+    struct buf_t head = {0}, body = {0}; /* comments, shell output */
+    int tochild[2], fromchild[2];
+    int open_in = 1, open_out = 1;
+    pid_t pid;
+    FILE *fp;
+    double ms;
+    size_t n;
+
+    if ((fp = fopen(trace, "r")) == NULL) {
+	fprintf(stderr, "tdriver: %s: %s\n", trace, strerror(errno));
+	exit(2);
+    }
+    if (pipe(tochild) < 0 || pipe(fromchild) < 0) {
+	perror("pipe");
+	exit(2);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((pid = fork()) < 0) {
+	perror("fork");
+	exit(2);
+    }
+    if (pid == 0) {
+	dup2(tochild[0], 0);
+	dup2(fromchild[1], 1);
+	close(tochild[0]); close(tochild[1]);
+	close(fromchild[0]); close(fromchild[1]);
+	close(outfd);
+	signal(SIGPIPE, SIG_DFL);
+	execv(shellargv[0], shellargv);
+	fprintf(stderr, "tdriver: exec of %s failed: %s\n", shellargv[0], strerror(errno));
+	exit(2);
+    }
+    close(tochild[0]);
+    close(fromchild[1]);
+
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	/* commands go to the shell as written; directives are trimmed */
+	line[strcspn(line, "\n")] = '\0';
+	if (line[0] == '#') {
+	    append(&head, line, strlen(line));
+	    append(&head, "\n", 1);
+	    continue;
+	}
+	for (p = line; isspace((unsigned char)*p); p++)
+	    ;
+	for (end = p + strlen(p); end > p && isspace((unsigned char)end[-1]); end--)
+	    ;
+	if (*p == '\0')
+	    continue;
+	memcpy(word, p, end - p);
+	word[end - p] = '\0';
+	p = word;
+
+	if (strcmp(p, "TSTP") == 0)
+	    kill(pid, SIGTSTP);
+	else if (strcmp(p, "INT") == 0)
+	    kill(pid, SIGINT);
+	else if (strcmp(p, "QUIT") == 0)
+	    kill(pid, SIGQUIT);
+	else if (strcmp(p, "KILL") == 0)
+	    kill(pid, SIGKILL);
+	else if (strcmp(p, "CLOSE") == 0) {
+	    if (open_in)
+		close(tochild[1]);
+	    open_in = 0;
+	}
+	else if (strcmp(p, "WAIT") == 0) {
+	    /* keep draining so the shell can't block on a full pipe */
+	    while (waitpid(pid, NULL, WNOHANG) == 0)
+		if (open_out && !drain(fromchild[0], &body, 10))
+		    open_out = 0;
+	    pid = 0;
+	}
+	else if (strncmp(p, "SLEEP ", 6) == 0 || strncmp(p, "MSLEEP ", 7) == 0) {
+	    ms = strtod(p + (p[0] == 'M' ? 7 : 6), NULL) * (p[0] == 'M' ? 1 : 1000);
+	    if (open_out && !drain(fromchild[0], &body, ms)) {
+		open_out = 0;
+		usleep(ms * 1000);
+	    }
+	}
+	else if (open_in) {
+	    n = strlen(line);
+	    line[n++] = '\n';
+	    if (write(tochild[1], line, n) != n && verbose)
+		fprintf(stderr, "tdriver: %s: shell stopped reading\n", trace);
+	}
+    }
+    fclose(fp);
+
+    /* close the shell's stdin, then read until every writer is gone */
+    if (open_in)
+	close(tochild[1]);
+    if (open_out)
+	drain(fromchild[0], &body, -1);
+    if (pid != 0)
+	waitpid(pid, NULL, 0);
+
+    if (write(outfd, head.data, head.len) != head.len
+	|| write(outfd, body.data, body.len) != body.len)
+	exit(2);
+    exit(0);
+}
+
+/*
+ * start - Fork a worker in its own process group to replay a trace
+ */
+void start(struct run_t *r)
+{
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+	perror("pipe");
+	exit(2);
+    }
+    r->start = now_ms();
+    if ((r->pid = fork()) < 0) {
+	perror("fork");
+	exit(2);
+    }
+    if (r->pid == 0) {
+	setpgid(0, 0);
+	close(fds[0]);
+	replay(r->trace, fds[1]);
+    }
+    setpgid(r->pid, r->pid);
+    close(fds[1]);
+    r->fd = fds[0];
+}
+
+/*
+ * normalize - Prepare an output line for comparison by masking PIDs.
+ *     Return 0 if the line should be skipped (/bin/ps listings).
+ */
+int normalize(const char *in, char *out)
+{
+    const char *p = in, *q;
+    char *start = out;
+
+    while (*p == ' ')
+	p++;
+    if (isdigit((unsigned char)*p)) {
+	for (q = p; isdigit((unsigned char)*q); q++)
+	    ;
+	if (*q == ' ')
+	    return 0;
+    }
+    if (strstr(in, "PID TTY") != NULL)
+	return 0;
+
+    for (p = in; *p && *p != '\n'; p++) {
+	if (*p == '(' && isdigit((unsigned char)p[1])) {
+	    for (q = p + 1; isdigit((unsigned char)*q); q++)
+		;
+	    if (*q == ')') {
+		strcpy(out, "(PID)");
+		out += 5;
+		p = q;
+		continue;
+	    }
+	}
+	*out++ = *p;
+    }
+    /* the reference output lost some trailing spaces */
+    while (out > start && out[-1] == ' ')
+	out--;
+    *out = '\0';
+    return 1;
+}
+
+/*
+ * reference - Return the section of the reference output for a trace
+ *     as a newly allocated string, or NULL if it has none.
+ */
+char *reference(const char *ref, const char *trace)
+{
+    const char *base = strrchr(trace, '/') ? strrchr(trace, '/') + 1 : trace;
+    char key[MAXLINE];
+    const char *p, *end;
+    char *section;
+
+    if (ref == NULL)
+	return NULL;
+    snprintf(key, sizeof(key), " -t %s ", base);
+    for (p = ref; (p = strstr(p, key)) != NULL; p++) {
+	while (p > ref && p[-1] != '\n')
+	    p--;
+	if (strncmp(p, "./sdriver.pl", 12) != 0)
+	    continue;
+	p = strchr(p, '\n');
+	if (p == NULL)
+	    return NULL;
+	p++;
+	for (end = p; *end; end = strchr(end, '\n') + 1) {
+	    if (strncmp(end, "./sdriver.pl", 12) == 0 || strncmp(end, "make[", 5) == 0)
+		break;
+	    if (strchr(end, '\n') == NULL) {
+		end += strlen(end);
+		break;
+	    }
+	}
+	section = malloc(end - p + 1);
+	memcpy(section, p, end - p);
+	section[end - p] = '\0';
+	return section;
+    }
+    return NULL;
+}
+
+/*
+ * compare - Compare output with the expected output line by line.
+ *     Return 1 if they match, otherwise print the first mismatch.
+ */
+int compare(const char *trace, char *got, char *want)
+{
+    char a[MAXLINE * 2], b[MAXLINE * 2];
+    char *gp = got, *wp = want, *gl, *wl;
+    int lineno = 0;
+
+    for (;;) {
+	gl = wl = NULL;
+	while (gp && *gp) {
+	    gl = gp;
+	    gp = strchr(gp, '\n');
+	    if (gp)
+		*gp++ = '\0';
+	    if (normalize(gl, a))
+		break;
+	    gl = NULL;
+	}
+	while (wp && *wp) {
+	    wl = wp;
+	    wp = strchr(wp, '\n');
+	    if (wp)
+		*wp++ = '\0';
+	    if (normalize(wl, b))
+		break;
+	    wl = NULL;
+	}
+	if (gl == NULL && wl == NULL)
+	    return 1;
+	lineno++;
+	if (gl == NULL || wl == NULL || strcmp(a, b) != 0) {
+	    printf("%s: line %d differs\n", trace, lineno);
+	    printf("    got:  %s\n", gl ? a : "(end of output)");
+	    printf("    want: %s\n", wl ? b : "(end of output)");
+	    return 0;
+	}
+    }
+}
+
+/*
+ * readfile - Read a whole file into a newly allocated string
+ */
+char *readfile(const char *path)
+{
+    struct buf_t b = {0};
+    char chunk[4096];
+    size_t n;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	fprintf(stderr, "tdriver: %s: %s\n", path, strerror(errno));
+	exit(2);
+    }
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+	append(&b, chunk, n);
+    append(&b, "", 1);
+    fclose(fp);
+    return b.data;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: tdriver [-hv] [-j <n>] [-s <shell>] [-a <args>] [-o <ref>] trace...\n");
+    fprintf(stderr, "   -h          print this message\n");
+    fprintf(stderr, "   -v          print the output of every trace\n");
+    fprintf(stderr, "   -j <n>      replay up to <n> traces at once (default 8)\n");
+    fprintf(stderr, "   -s <shell>  shell program to test (default ./tsh)\n");
+    fprintf(stderr, "   -a <args>   shell arguments (default -p)\n");
+    fprintf(stderr, "   -o <ref>    compare against reference output, e.g. tshref.out\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    struct run_t runs[MAXRUNS];
+    struct pollfd pfds[MAXRUNS];
+    int map[MAXRUNS];
+    char *shell = "./tsh", *args = "-p", *reffile = NULL, *ref = NULL;
+    char *want, chunk[4096], *tok;
+    int c, i, n, nruns, next = 0, active = 0, jobs = 8, failed = 0, nargs = 0;
+    double total;
+
+    while ((c = getopt(argc, argv, "hvj:s:a:o:")) != -1) {
+	switch (c) {
+	case 'v':
+	    verbose = 1;
+	    break;
+	case 'j':
+	    if ((jobs = atoi(optarg)) < 1)
+		usage();
+	    break;
+	case 's':
+	    shell = optarg;
+	    break;
+	case 'a':
+	    args = optarg;
+	    break;
+	case 'o':
+	    reffile = optarg;
+	    break;
+	default:
+	    usage();
+	}
+    }
+    nruns = argc - optind;
+    if (nruns < 1 || nruns > MAXRUNS)
+	usage();
+    if (access(shell, X_OK) < 0) {
+	fprintf(stderr, "tdriver: %s is not executable\n", shell);
+	exit(2);
+    }
+    if (reffile)
+	ref = readfile(reffile);
+
+    shellargv[nargs++] = shell;
+    args = strdup(args);
+    for (tok = strtok(args, " "); tok && nargs < MAXARGS - 1; tok = strtok(NULL, " "))
+	shellargv[nargs++] = tok;
+    shellargv[nargs] = NULL;
+
+    memset(runs, 0, sizeof(runs));
+    for (i = 0; i < nruns; i++)
+	runs[i].trace = argv[optind + i];
+
+    /* keep up to jobs workers busy and collect their output */
+    total = now_ms();
+    while (next < nruns || active > 0) {
+	while (active < jobs && next < nruns) {
+	    start(&runs[next++]);
+	    active++;
+	}
+
+	for (i = n = 0; i < next; i++) {
+	    if (runs[i].pid != 0) {
+		pfds[n].fd = runs[i].fd;
+		pfds[n].events = POLLIN;
+		map[n++] = i;
+	    }
+	}
+	if (poll(pfds, n, -1) < 0 && errno != EINTR) {
+	    perror("poll");
+	    exit(2);
+	}
+
+	for (i = 0; i < n; i++) {
+	    struct run_t *r = &runs[map[i]];
+	    int len;
+
+	    if (pfds[i].revents == 0)
+		continue;
+	    if ((len = read(r->fd, chunk, sizeof(chunk))) > 0) {
+		append(&r->out, chunk, len);
+		continue;
+	    }
+	    close(r->fd);
+	    waitpid(r->pid, &r->status, 0);
+	    r->ms = now_ms() - r->start;
+	    r->pid = 0;
+	    active--;
+	}
+    }
+    total = now_ms() - total;
+
+    /* report in trace order */
+    for (i = 0; i < nruns; i++) {
+	struct run_t *r = &runs[i];
+
+	append(&r->out, "", 1);
+	if (verbose)
+	    fputs(r->out.data, stdout);
+	if (!WIFEXITED(r->status) || WEXITSTATUS(r->status) != 0) {
+	    printf("%s: FAILED (driver error)\n", r->trace);
+	    failed++;
+	}
+	else if (ref == NULL) {
+	    printf("%s: done (%.0f ms)\n", r->trace, r->ms);
+	}
+	else if ((want = reference(ref, r->trace)) == NULL) {
+	    printf("%s: no reference output (%.0f ms)\n", r->trace, r->ms);
+	}
+	else {
+	    if (compare(r->trace, r->out.data, want))
+		printf("%s: ok (%.0f ms)\n", r->trace, r->ms);
+	    else
+		failed++;
+	    free(want);
+	}
+    }
+    printf("%d of %d traces passed in %.0f ms\n", nruns - failed, nruns, total);
+    exit(failed ? 1 : 0);
+}
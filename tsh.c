@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* pipe2, vmsplice, F_SETPIPE_SZ, prlimit */
 /* tsh - A tiny shell program with job control
  * CISC 361 - Lab 1 (Simple Shell)
  * Benjamin Steenkamer
@@ -12,13 +13,36 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
 #include <errno.h>
+#include "tshstat.h"
 
 /* Misc manifest constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
+#define MAXJOBS     256   /* max jobs at any point in time */
 #define MAXJID    1<<16   /* max job ID */
+#if MAXJOBS != STAT_JOBS
+#error "the status page needs a slot for every job"
+#endif
+#define MAXSCRIPTS    8   /* max compiled scripts kept in the cache */
+#define MAXVARS      64   /* max script variables */
+#define MAXVARNAME   32   /* max size of a script variable name */
+#define MAXDEPTH     16   /* max nesting of sourced scripts */
+#define MAXREDIRS     8   /* max redirections on a command line */
+#define MAXHERE   65536   /* max size of a here-document */
+#define TRACEBUF   4096   /* trace events buffered before a flush */
+#define BACKOFF     100   /* default supervise restart delay (ms) */
+#define MAXBACKOFF 60000  /* longest supervise restart delay (ms) */
+#define RESETRUN  10000   /* a supervised job that ran this long (ms) restarts at the base delay again */
+#define NLIMITS       4   /* number of resource limits a job can be given */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -36,20 +60,166 @@
  * At most 1 job can be in the FG state.
  */
 
+/* Redirection operators */
+#define R_IN     0 /* fd < path */
+#define R_OUT    1 /* fd > path */
+#define R_APPEND 2 /* fd >> path */
+#define R_DUP    3 /* fd >& fd2 */
+#define R_HERE   4 /* fd <<< text, or a here-document */
+
+/* Supervise restart policies */
+#define RESTART_NONE   0 /* not supervised */
+#define RESTART_ALWAYS 1 /* restart whenever the job exits */
+#define RESTART_FAIL   2 /* restart when it exits nonzero or is killed */
+
+/* Script opcodes */
+#define OP_RUN     0 /* run command cmds[a] */
+#define OP_JFALSE  1 /* jump to b if the last status is nonzero */
+#define OP_JUMP    2 /* jump to b */
+#define OP_FORINIT 3 /* rewind for loop a */
+#define OP_FORNEXT 4 /* bind the next word of loop a, or jump to b when done */
+
+/* Block terminators returned by the script compiler */
+#define KW_ERROR  -1 /* syntax error */
+#define KW_EOF     0 /* end of file */
+#define KW_ELSE    1 /* else */
+#define KW_FI      2 /* fi */
+#define KW_DONE    3 /* done */
+
 /* Global variables */
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
+int subreaper = 0;          /* if true, jobs last until their whole process tree exits */
 int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
+struct limits_t {           /* Resource limits for a job */
+    int set;                /* bit i is set if rlim[i] applies */
+    rlim_t rlim[NLIMITS];   /* soft and hard limit for limitres[i] */
+};
+int limitres[NLIMITS] = {RLIMIT_AS, RLIMIT_CPU, RLIMIT_NOFILE, RLIMIT_NPROC};
+char *limitnames[NLIMITS] = {"as", "cpu", "nofile", "nproc"};
+struct limits_t deflimits;  /* limits every new job gets, set with limit */
+
+struct redir_t {            /* One redirection */
+    int op;                 /* R_IN, R_OUT, ... */
+    int fd;                 /* file descriptor being redirected */
+    int fd2;                /* R_DUP: descriptor to copy */
+    char *arg;              /* path, or the text of a here-string */
+    int newline;            /* R_HERE: add a newline after the text? */
+};
+
 struct job_t {              /* The job struct */
     pid_t pid;              /* job PID */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
     char cmdline[MAXLINE];  /* command line */
+    int restart;            /* supervise restart policy: RESTART_NONE, ... */
+    int backoff;            /* base restart delay (ms) */
+    int delay;              /* delay before the next restart (ms) */
+    int restarts;           /* number of restarts so far */
+    int lastexit;           /* wait status of the last exit, -1 if none */
+    struct timespec started; /* when the current process was started */
+    int argc;               /* number of arguments in args */
+    char args[MAXLINE];     /* NUL separated argv to restart the job with */
+    struct redir_t redirs[MAXREDIRS]; /* redirections to restart the job with */
+    int nredirs;            /* number of redirections in redirs */
+    char redirargs[MAXLINE]; /* storage for the redirections' paths and text */
+    struct limits_t limits; /* resource limits the job was started with */
+    long long cpu;          /* CPU time (us) of the job's processes that exited */
+    int leaderstatus;       /* -R: wait status of a leader whose tree still runs, -1 if none */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
+
+volatile sig_atomic_t last_status = 0; /* exit status of the last command */
+
+/*
+ * A sourced script is compiled once into a flat instruction array.
+ * Commands are stored pre-tokenized; each argument is a run of
+ * segments that are either literal text in the pool or a variable.
+ */
+struct insn_t {             /* One script instruction */
+    int op;                 /* OP_RUN, OP_JFALSE, ... */
+    int a;                  /* command or loop index */
+    int b;                  /* jump target */
+};
+struct seg_t {              /* Piece of a word */
+    int off;                /* offset of literal text in the pool */
+    int var;                /* variable slot, or -1 for literal text */
+};
+struct word_t {             /* One argument */
+    int seg;                /* first segment */
+    int nseg;               /* number of segments */
+};
+struct scmd_t {             /* One command line */
+    int word;               /* first word */
+    int argc;               /* number of words */
+    int bg;                 /* run in the background? */
+    int redir;              /* first redirection */
+    int nredirs;            /* number of redirections */
+};
+struct sredir_t {           /* One redirection of a command */
+    int op, fd, fd2, newline; /* as in redir_t */
+    int word;               /* target word, or -1 for R_DUP */
+};
+struct sloop_t {            /* One for loop */
+    int var;                /* loop variable slot */
+    int word;               /* first word of the list */
+    int nwords;             /* number of words in the list */
+};
+struct script_t {           /* A compiled script */
+    char path[MAXLINE];     /* file it was compiled from */
+    struct timespec mtime;  /* modification time when compiled */
+    int cached;             /* lives in the script cache? */
+    int busy;               /* number of active runs */
+    unsigned long lastuse;  /* for picking a cache victim */
+    struct insn_t *code;  int ncode, capcode;
+    struct scmd_t *cmds;  int ncmds, capcmds;
+    struct sredir_t *redirs; int nredirs, capredirs;
+    struct sloop_t *loops; int nloops, caploops;
+    struct word_t *words; int nwords, capwords;
+    struct seg_t *segs;   int nsegs, capsegs;
+    char *pool;           int npool, cappool;
+};
+struct var_t {              /* A script variable */
+    char name[MAXVARNAME];  /* variable name */
+    char value[MAXLINE];    /* current value */
+};
+struct script_t scripts[MAXSCRIPTS]; /* The script cache */
+unsigned long scriptclock = 0;       /* ticks on every cache lookup */
+int sourcedepth = 0;                 /* current nesting of sourced scripts */
+struct var_t vars[MAXVARS];          /* Script variables */
+int nvars = 0;                       /* number of variables in use */
+
+/*
+ * With -T, job lifecycle events are collected in a fixed buffer and
+ * written out in batches as Chrome trace-event JSON. Each process gets
+ * its own track (tid); the shell's own work is on the shell's track.
+ */
+struct tevent_t {           /* One trace event */
+    long long ts;           /* microseconds since the shell started */
+    long long dur;          /* duration of an 'X' event */
+    char ph;                /* phase: B(egin), E(nd), X (complete), i(nstant), M(etadata) */
+    const char *name;       /* event name */
+    pid_t tid;              /* track */
+    const char *argname;    /* name of arg, or NULL */
+    int arg;                /* value of arg */
+    char label[64];         /* 'M' events: track name */
+};
+int tracefd = -1;                    /* trace file, -1 if not tracing */
+pid_t tracepid;                      /* the shell's PID */
+long long tracestart;                /* when the shell started (us) */
+int ntrace = 0;                      /* events in tracebuf */
+int tracewritten = 0;                /* events already written to the file */
+struct tevent_t tracebuf[TRACEBUF];  /* events not written yet */
+
+/*
+ * With -S, the job list is mirrored into a shared memory page that
+ * monitors read without involving the shell. See tshstat.h.
+ */
+struct stat_page_t *statpage = NULL; /* the page, NULL if not publishing */
+pid_t statpid;                       /* the shell's PID */
 /* End global variables */
 
 
@@ -57,8 +227,17 @@ struct job_t jobs[MAXJOBS]; /* The job list */
 
 /* Here are the functions that you will implement */
 void eval(char *cmdline);
+void runargv(char **argv, int bg, char *cmdline, struct redir_t *redirs, int nredirs);
+pid_t launch(char **argv, int bg, char *cmdline, struct redir_t *redirs, int nredirs, struct limits_t *lim);
+int isbuiltin(char *name);
 int builtin_cmd(char **argv);
 void do_bgfg(char **argv);
+void do_kill(char **argv);
+void do_disown(char **argv);
+void do_source(char **argv);
+void do_supervise(char **argv, struct redir_t *redirs, int nredirs);
+void do_limit(char **argv);
+void do_prlimit(char **argv);
 void waitfg(pid_t pid);
 
 void sigchld_handler(int sig);
@@ -66,7 +245,7 @@ void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, char **argv);
+int parseline(const char *cmdline, char **argv, char *quoted);
 void sigquit_handler(int sig);
 
 void clearjob(struct job_t *job);
@@ -78,11 +257,54 @@ pid_t fgpid(struct job_t *jobs);
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid);
 int pid2jid(pid_t pid);
+void restartjob(struct job_t *job, int status);
 void listjobs(struct job_t *jobs);
+int selectjobs(char *cmd, char **specs, int *sel, pid_t *others, int *nothers);
+
+void *grow(void *arr, int need, int *cap, size_t size);
+int lookupvar(const char *name, int len);
+int emitinsn(struct script_t *s, int op, int a, int b);
+int compilewords(struct script_t *s, char **argv);
+int compilecmd(struct script_t *s, char **argv, int bg, struct redir_t *redirs, int nredirs);
+int compileblock(struct script_t *s, FILE *fp, int *lineno);
+int compilescript(struct script_t *s, const char *path);
+void freescript(struct script_t *s);
+struct script_t *loadscript(const char *path);
+int expandword(struct script_t *s, struct word_t *w, char *buf, int size);
+void runcmd(struct script_t *s, struct scmd_t *cmd);
+void runscript(struct script_t *s);
+
+int readheredoc(FILE *fp, const char *delim, char *buf, int size);
+int parseredirs(char **argv, const char *quoted, struct redir_t *redirs, FILE *fp, char *heredoc);
+int feedpipe(int fd, const char *text, int newline, int byref);
+int applyredirs(struct redir_t *redirs, int nredirs, int forked);
+
+int parselimits(char *cmd, char **settings, int n, struct limits_t *lim);
+char *fmtlimit(rlim_t value, char *buf);
+void mkrlimit(int i, rlim_t value, struct rlimit *rl);
+int applylimits(struct limits_t *lim);
+int prlimitgroup(pid_t pgid, int resource, struct rlimit *rlim);
+char *limitkill(struct job_t *job, int status, struct rusage *ru);
+
+long long traceclock(void);
+void traceopen(char *path);
+void tracerecord(struct tevent_t *e);
+void trace(char ph, const char *name, pid_t tid, const char *argname, int arg);
+void tracespan(const char *name, long long start, pid_t tid, const char *argname, int arg);
+void tracename(pid_t tid, int jid, char *cmdline);
+void tracestate(struct job_t *job, int state);
+void traceflush(void);
+void traceclose(void);
+
+void statopen(void);
+void statjob(struct job_t *job);
+void statclose(void);
 
 void usage(void);
+void flushout(void);
 void unix_error(char *msg);
 void app_error(char *msg);
+int signum(const char *name);
 typedef void handler_t(int);
 handler_t *Signal(int signum, handler_t *handler);
 
@@ -101,7 +323,7 @@ int main(int argc, char **argv){
     }
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpRST:")) != EOF) {
         switch (c) {
             case 'h':             /* print help message */
                 usage();
@@ -112,6 +334,17 @@ int main(int argc, char **argv){
             case 'p':             /* don't print a prompt */
                 emit_prompt = 0;  /* handy for automatic testing */
     	        break;
+            case 'R':             /* adopt and reap orphaned descendants */
+                if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+                    unix_error("prctl error");
+                subreaper = 1;
+                break;
+            case 'S':             /* publish the job list */
+                statopen();
+                break;
+            case 'T':             /* record a job timeline */
+                traceopen(optarg);
+                break;
 	        default:
                 usage();
 	    }
@@ -135,19 +368,19 @@ int main(int argc, char **argv){
     	/* Read command line */
     	if (emit_prompt){
     	    printf("%s", prompt);
-    	    fflush(stdout);
+    	    flushout();
     	}
     	if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
     	    app_error("fgets error");
     	if (feof(stdin)) { /* End of file (ctrl-d) */
-    	    fflush(stdout);
+    	    flushout();
     	    exit(0);
     	}
 
     	/* Evaluate the command line */
-        fflush(stdout);
+        flushout();
     	eval(cmdline);
-    	fflush(stdout);
+    	flushout();
     }
 
     exit(0); /* control never reaches here */
@@ -166,108 +399,264 @@ int main(int argc, char **argv){
 */
 void eval(char *cmdline){
     char *argv[MAXARGS]; //Contains the command line command and arguments.
+    char quoted[MAXARGS]; //Which arguments were in quotes.
     int bg; //True if the job will run in the bg.
-    pid_t pid; //Process ID of the job.
+    struct redir_t redirs[MAXREDIRS]; //Redirections taken out of argv.
+    static char heredoc[MAXHERE]; //Body of a here-document read from stdin.
+    int nredirs;
+    long long start = traceclock(); //When parsing started, for the timeline.
 
     //Parse the cmdline and put it into argv format.
     //Also set whether the process is to run in the bg.
-    bg = parseline(cmdline, argv);
+    bg = parseline(cmdline, argv, quoted);
 
     //Ignore any blank inputs.
     if(argv[0] == NULL){
         return;
     }
 
+    //Take the redirections out of argv. A here-document is read from stdin.
+    if((nredirs = parseredirs(argv, quoted, redirs, stdin, heredoc)) < 0){
+        last_status = 1;
+        return;
+    }
+    tracespan("parse", start, tracepid, NULL, 0);
+
+    runargv(argv, bg, cmdline, redirs, nredirs);
+
+    return;
+}
+
+/*
+ * runargv - Run a parsed command. A built-in command runs right away
+ *    in the shell, with its redirections applied around it and undone
+ *    afterwards so it never needs a fork. Anything else becomes a job.
+ */
+void runargv(char **argv, int bg, char *cmdline, struct redir_t *redirs, int nredirs){
+    int saved[10]; //Copies of the descriptors a builtin's redirections replace, -2 if closed.
+    struct limits_t lim = deflimits; //Resource limits for a job started here.
+    int i;
+
+    //Ignore commands that were nothing but redirections.
+    if(argv[0] == NULL){
+        return;
+    }
+
+    //"limit name=value... cmd" runs cmd with those limits on top of the defaults.
+    if(strcmp(argv[0], "limit") == 0){
+        for(i = 1; argv[i] != NULL && strchr(argv[i], '=') != NULL; i++)
+            ;
+        if(argv[i] != NULL){
+            if(parselimits(argv[0], argv + 1, i - 1, &lim) < 0){
+                last_status = 1;
+                return;
+            }
+            argv += i;
+            if(isbuiltin(argv[0])){
+                printf("limit: %s: only external commands can be limited\n", argv[0]);
+                last_status = 1;
+                return;
+            }
+        }
+    }
+
+    //supervise keeps its redirections for every run of its job, so they
+    //are not applied to the shell around it like other builtins.
+    if(strcmp(argv[0], "supervise") == 0){
+        last_status = 0;
+        do_supervise(argv, redirs, nredirs);
+        return;
+    }
+
     //See if command is built in. If it is, run it right away.
     //Otherwise, create a job to handle it.
-    if(!builtin_cmd(argv)){
+    if(nredirs == 0 || !isbuiltin(argv[0])){
+        if(!builtin_cmd(argv)){
+            launch(argv, bg, cmdline, redirs, nredirs, &lim);
+        }
+        return;
+    }
+
+    flushout();
+    for(i = 0; i < 10; i++){
+        saved[i] = -1;
+    }
+    for(i = 0; i < nredirs; i++){
+        if(saved[redirs[i].fd] == -1 && (saved[redirs[i].fd] = fcntl(redirs[i].fd, F_DUPFD_CLOEXEC, 10)) < 0){
+            saved[redirs[i].fd] = -2;
+        }
+    }
 
-        //Parent blocks SIGCHLD signals before fork to avoid race condition.
-        sigset_t mask;
+    if(applyredirs(redirs, nredirs, 0) == 0){
+        builtin_cmd(argv);
+    }
+    else{
+        last_status = 1;
+    }
+    flushout();
 
-        //Initialize the signal set pointed to by mask.
-        if(sigemptyset(&mask) < 0){
-            //Returning a negative value means it was not able to initialize the signal set.
-            unix_error("sigemptyset error");
+    //Put the shell's own descriptors back.
+    for(i = 0; i < 10; i++){
+        if(saved[i] >= 0){
+            dup2(saved[i], i);
+            close(saved[i]);
         }
+        else if(saved[i] == -2){
+            close(i);
+        }
+    }
+
+    return;
+}
+
+/*
+ * launch - Fork a child that runs argv as a new job in its own process
+ *    group. If the job is running in the foreground, wait for it to
+ *    terminate. Otherwise print out details on the bg job. Both eval
+ *    and the script interpreter start their jobs here. Return the PID.
+ *    The caller's signal mask is restored, so a caller that blocked
+ *    SIGCHLD can still update the job before it is reaped. The child
+ *    gets the resource limits in lim before it runs the program.
+ */
+pid_t launch(char **argv, int bg, char *cmdline, struct redir_t *redirs, int nredirs, struct limits_t *lim){
+    pid_t pid; //Process ID of the job.
+    struct job_t *job;
+    int execpipe[2] = {-1, -1}; //Closed by a successful exec when tracing.
+    long long start; //When the fork started, for the timeline.
+    char failed;
+    ssize_t n;
+
+    //Parent blocks SIGCHLD signals before fork to avoid race condition.
+    sigset_t mask, prev;
+
+    //Initialize the signal set pointed to by mask.
+    if(sigemptyset(&mask) < 0){
+        //Returning a negative value means it was not able to initialize the signal set.
+        unix_error("sigemptyset error");
+    }
+
+    //Add SIGCHLD to the mask signal set pointed to by mask.
+    if(sigaddset(&mask, SIGCHLD) < 0){
+        //Returning a negative value means it was not able to add SIGCHLD to the signal set.
+        unix_error("sigaddset error");
+    }
+
+    //Change the signal mask to have SIG_BLOCK.
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        //Returning a negative value means it was not able change the signal mask.
+        unix_error("sigprocmask error (SIG_BLOCK)");
+    }
+
+    //When tracing, the child's exec closes this pipe so the parent can see when it happens.
+    if(tracefd >= 0 && pipe2(execpipe, O_CLOEXEC) < 0){
+        unix_error("pipe error");
+    }
+
+    //Create a child process to run the new job.
+    start = traceclock();
+    if((pid = fork()) < 0){
+        //If fork returns a negative value, it failed to create a child process.
+        unix_error("fork error");
+    }
+
+    //The child now runs the new job.
+    if(pid == 0){
 
-        //Add SIGCHLD to the mask signal set pointed to by mask.
-        if(sigaddset(&mask, SIGCHLD) < 0){
-            //Returning a negative value means it was not able to add SIGCHLD to the signal set.
-            unix_error("sigaddset error");
+        //Give child a new process group ID so bg children don't receive SIGINT or SIGTSTP from ctrl+c.
+        if(setpgid(0,0) < 0){
+            unix_error("setpgid error"); //Unable to set group ID of child process.
         }
 
-        //Change the signal mask to have SIG_BLOCK.
-        if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0){
-            //Returning a negative value means it was not able change the signal mask.
-            unix_error("sigprocmask error (SIG_BLOCK)");
+        //Unblock SIGCHLD signals since child inherited blocked vectors from parent.
+        if(sigprocmask(SIG_UNBLOCK,&mask,NULL) < 0){
+            //Returning a negative value means it was not able change the signal mask to have SIG_UNBLOCK.
+            unix_error("sigprocmask error (SIG_UNBLOCK)");
         }
 
-        //Create a child process to run the new job.
-        if((pid = fork()) < 0){
-            //If fork returns a negative value, it failed to create a child process.
-            unix_error("fork error");
+        //Point stdin, stdout and stderr where the command line asked.
+        if(applyredirs(redirs, nredirs, 1) < 0){
+            exit(1);
         }
 
-        //The child now runs the new job.
-        if(pid == 0){
+        //Cap what the job can use before it starts.
+        if(applylimits(lim) < 0){
+            exit(1);
+        }
 
-            //Give child a new process group ID so bg children don't receive SIGINT or SIGTSTP from ctrl+c.
-            if(setpgid(0,0) < 0){
-                unix_error("setpgid error"); //Unable to set group ID of child process.
+        //Run the program.
+        if(execve(argv[0], argv, environ) < 0){
+            //If execve() returns a negative value, the program could not be found.
+            printf("%s: Command not found\n", argv[0]);
+            if(execpipe[1] >= 0){
+                failed = 1;
+                write(execpipe[1], &failed, 1);
             }
+            exit(127);
+        }
+    }
+    tracespan("fork", start, tracepid, "pid", pid);
 
-            //Unblock SIGCHLD signals since child inherited blocked vectors from parent.
-            if(sigprocmask(SIG_UNBLOCK,&mask,NULL) < 0){
-                //Returning a negative value means it was not able change the signal mask to have SIG_UNBLOCK.
-                unix_error("sigprocmask error (SIG_UNBLOCK)");
-            }
+    //Set the child's process group from the parent too, so the group exists
+    //before anyone signals it. The child may already have done so and exec'd.
+    if(setpgid(pid, pid) < 0 && errno != EACCES){
+        unix_error("setpgid error");
+    }
 
-            //Run the program.
-            if(execve(argv[0], argv, environ) < 0){
-                //If execve() returns a negative value, the program could not be found.
-                printf("%s: Command not found.\n", argv[0]);
-                exit(0);
-            }
+    //Wait for the exec so it shows up on the job's track.
+    if(execpipe[0] >= 0){
+        close(execpipe[1]);
+        while((n = read(execpipe[0], &failed, 1)) < 0 && errno == EINTR)
+            ;
+        trace('i', n == 0 ? "exec" : "exec failed", pid, NULL, 0);
+        close(execpipe[0]);
+    }
+
+    //The parent must now either wait on the fg job or print out details on the bg job.
+    if(!bg){ //The created job is running in the fg.
+        addjob(jobs, pid, FG, cmdline); //Add the fg job to the job list.
+        if((job = getjobpid(jobs, pid)) != NULL){
+            job->limits = *lim; //Remember the limits for prlimit and restarts.
         }
 
-        //The parent must now either wait on the fg job or print out details on the bg job.
-        if(!bg){ //The created job is running in the fg.
-            addjob(jobs, pid, FG, cmdline); //Add the fg job to the job list.
+        //Restore the caller's signal mask.
+        if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+            //Returning a negative value means it was not able change the signal mask.
+            unix_error("sigprocmask error (SIG_SETMASK)");
+        }
 
-            //Unblock SIGCHLD signals.
-            if(sigprocmask(SIG_UNBLOCK, &mask, NULL) < 0){
-                //Returning a negative value means it was not able change the signal mask to have SIG_UNBLOCK.
-                unix_error("sigprocmask error (SIG_UNBLOCK)");
-            }
+        waitfg(pid); //Wait on the fg job to finish before proceeding.
+    }
+    else{ //The created job is running in the bg.
+        addjob(jobs, pid, BG, cmdline); //Add the bg job to the job list.
+        if((job = getjobpid(jobs, pid)) != NULL){
+            job->limits = *lim; //Remember the limits for prlimit and restarts.
+        }
 
-            waitfg(pid); //Wait on the fg job to finish before proceeding.
+        //Restore the caller's signal mask.
+        if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+            //Returning a negative value means it was not able change the signal mask.
+            unix_error("sigprocmask error (SIG_SETMASK)");
         }
-        else{ //The created job is running in the bg.
-            addjob(jobs, pid, BG, cmdline); //Add the bg job to the job list.
 
-            //Unblock SIGCHLD signals.
-            if(sigprocmask(SIG_UNBLOCK,&mask,NULL) < 0){
-                //Returning a negative value means it was not able change the signal mask to have SIG_UNBLOCK.
-                unix_error("sigprocmask error (SIG_UNBLOCK)");
-            }
+        //Starting a bg job always succeeds as far as a script is concerned.
+        last_status = 0;
 
-            //Print out details on the bg job.
-            printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
-        }
+        //Print out details on the bg job.
+        printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
     }
 
-    return;
+    return pid;
 }
 
 /*
  * parseline - Parse the command line and build the argv array.
  *
  * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.
+ * argument, and quoted[i] is set if argv[i] was one.  Return true if
+ * the user has requested a BG job, false if the user has requested a
+ * FG job.
  */
-int parseline(const char *cmdline, char **argv){
+int parseline(const char *cmdline, char **argv, char *quoted){
 
     static char array[MAXLINE]; /* holds local copy of command line */
     char *buf = array;          /* ptr that traverses command line */
@@ -282,7 +671,7 @@ int parseline(const char *cmdline, char **argv){
 
     /* Build the argv list */
     argc = 0;
-    if (*buf == '\'') {
+    if ((quoted[argc] = (*buf == '\'')) != 0) {
 	buf++;
 	delim = strchr(buf, '\'');
     }
@@ -290,14 +679,14 @@ int parseline(const char *cmdline, char **argv){
 	delim = strchr(buf, ' ');
     }
 
-    while (delim) {
+    while (delim && argc < MAXARGS - 1) {
 	argv[argc++] = buf;
 	*delim = '\0';
 	buf = delim + 1;
 	while (*buf && (*buf == ' ')) /* ignore spaces */
 	       buf++;
 
-	if (*buf == '\'') {
+	if ((quoted[argc] = (*buf == '\'')) != 0) {
 	    buf++;
 	    delim = strchr(buf, '\'');
 	}
@@ -317,12 +706,31 @@ int parseline(const char *cmdline, char **argv){
     return bg;
 }
 
+/*
+ * isbuiltin - Return 1 if name is a built-in command, 0 otherwise
+ */
+int isbuiltin(char *name){
+    static char *builtins[] = {"quit", "jobs", "bg", "fg", "kill", "disown", "supervise", "source", "limit", "prlimit", NULL};
+    int i;
+
+    for(i = 0; builtins[i] != NULL; i++){
+        if(strcmp(name, builtins[i]) == 0){
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
 /*
  * builtin_cmd - If the user has typed a built-in command then execute
  *    it immediately. Return 0 if it is not a built-in command.
  *    Return 1 if it is a built-in command.
  */
 int builtin_cmd(char **argv){
+    //Builtins succeed unless they say otherwise.
+    last_status = 0;
+
     if(strcmp(argv[0], "quit") == 0){
         //Exit the shell.
         exit(0);
@@ -345,165 +753,700 @@ int builtin_cmd(char **argv){
 
         return 1;
     }
+    else if(strcmp(argv[0], "kill") == 0){
+        //Send a signal to jobs or processes.
+        do_kill(argv);
+
+        return 1;
+    }
+    else if(strcmp(argv[0], "disown") == 0){
+        //Forget about jobs without signalling them.
+        do_disown(argv);
+
+        return 1;
+    }
+    else if(strcmp(argv[0], "source") == 0){
+        //Run a script in the context of this shell.
+        do_source(argv);
+
+        return 1;
+    }
+    else if(strcmp(argv[0], "limit") == 0){
+        //Show or set the resource limits new jobs get.
+        do_limit(argv);
+
+        return 1;
+    }
+    else if(strcmp(argv[0], "prlimit") == 0){
+        //Show or change the resource limits of running jobs.
+        do_prlimit(argv);
+
+        return 1;
+    }
 
     return 0;     /* not a builtin command */
 }
 
 /*
- * do_bgfg - Execute the builtin bg and fg commands
+ * do_bgfg - Execute the builtin bg and fg commands. bg accepts any
+ *    number of job specs and resumes every selected job in one pass over
+ *    the job list. fg needs a spec that names exactly one job.
  */
 void do_bgfg(char **argv){
-    struct job_t *job;
+    int sel[MAXJOBS]; //sel[i] is true if jobs[i] was named on the command line.
+    int i, n;
+    struct job_t *job = NULL;
+    sigset_t mask, prev;
 
     //If bg of fg command is entered with no argument, it is invalid.
     if(argv[1] == NULL){
         printf("%s command requires PID or %%jobid argument\n", argv[0]);
+        last_status = 1;
         return;
     }
 
-    //Arguements for bg can be a "%JID" or "PID".
-    //If arguement is a %JID.
-    if((argv[1][0] == '%')){
-        if(atoi(argv[1] + 1) == 0){ //If bg or fg command is entered with the argument %NaN, it is invalid.
-            printf("%s: argument must be a PID or %%jobid\n", argv[0]);
-            return;
+    //Keep the reaper out of the job list while it is being walked.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (do_bgfg)");
+    }
+
+    //A script can test whether any job was resumed.
+    if((n = selectjobs(argv[0], argv + 1, sel, NULL, NULL)) <= 0){
+        last_status = 1;
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+    }
+    if(strcmp(argv[0], "fg") == 0 && n > 1){
+        printf("%s: only one job can run in the foreground\n", argv[0]);
+        last_status = 1;
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+    }
+
+    for(i = 0; i < MAXJOBS; i++){
+        if(!sel[i]){
+            continue;
         }
+        job = &jobs[i];
 
-        //Convert the JID to an integer (skipping the % symbol) and find the corresponding job.
-        job = getjobjid(jobs, atoi(argv[1] + 1));
+        //Send the start signal to the stopped job.
+        //Use -PID so SIGCONT is sent to all processes with process group ID(PGID) equal to |-PID|.
+        if(kill(-(job->pid), SIGCONT) < 0){
+            //If kill returns a negative value, it was not able to send the signal.
+            unix_error("kill error (do_bgfg)");
+        }
 
-        //If no job was found.
-        if(job == NULL){
-            printf("%s: No such job\n", argv[1]);
-            return;
+        //Update the job's status.
+        if(strcmp(argv[0], "bg") == 0){//Set the job's status to running in the bg.
+            tracestate(job, BG);
+            job->state = BG;
+            statjob(job);
+
+            //Now that the job is running in the bg, print out the bg job details.
+            printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
         }
-    }
-    else{// If arguement is a PID.
-        if(atoi(argv[1]) == 0){ //If bg of fg command is entered with the argument NaN, it is invalid.
-            printf("%s: argument must be a PID or %%jobid\n", argv[0]);
-            return;
+        else{//Set the job's status to running in the fg.
+            tracestate(job, FG);
+            job->state = FG;
+            statjob(job);
         }
+    }
 
-        //Convert the arguemnt (a PID) to an interger and find the corresponding job.
-        job = getjobpid(jobs, atoi(argv[1])); //argv[1] contains the PID
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (do_bgfg)");
+    }
+
+    //Now that the job is running in the fg, must wait until it is finshed.
+    if(strcmp(argv[0], "fg") == 0){
+        waitfg(job->pid);
+    }
 
-        //If no job was found.
-        if(job == NULL){
-            printf("(%d): No such process\n", atoi(argv[1]));
+    return;
+}
+
+/*
+ * do_kill - Execute the builtin kill command: kill [-SIG] spec...
+ *    The signal (SIGTERM by default) goes to each selected job's whole
+ *    process group in one pass over the job list. PIDs that are not
+ *    jobs are signalled directly.
+ */
+void do_kill(char **argv){
+    int sel[MAXJOBS];     //sel[i] is true if jobs[i] was named on the command line.
+    pid_t others[MAXARGS]; //PIDs named on the command line that aren't jobs.
+    int nothers = 0;
+    int i, sig = SIGTERM;
+    char **specs = argv + 1;
+    sigset_t mask, prev;
+
+    //An optional -SIG comes before the job specs.
+    if(*specs != NULL && (*specs)[0] == '-'){
+        if((sig = signum((*specs) + 1)) < 0){
+            printf("%s: %s: invalid signal specification\n", argv[0], (*specs) + 1);
+            last_status = 1;
             return;
         }
+        specs++;
+    }
+    if(*specs == NULL){
+        printf("%s command requires PID or %%jobid argument\n", argv[0]);
+        last_status = 1;
+        return;
     }
 
-    //Send the start signal to the stopped job.
-    //Use -PID so SIGCONT is sent to all processes with process group ID(PGID) equal to |-PID|.
-    if(kill(-(job->pid), SIGCONT) < 0){
-        //If kill returns a negative value, it was not able to send the signal.
-        unix_error("kill error (do_bgfg)");
+    //Keep the reaper out of the job list while it is being walked.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (do_kill)");
     }
 
-    //Update the job's status.
-    if(strcmp(argv[0], "bg") == 0){//Set the job's status to running in the bg.
-        job->state= BG;
+    if(selectjobs(argv[0], specs, sel, others, &nothers) < 0){
+        last_status = 1;
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+    }
+
+    for(i = 0; i < MAXJOBS; i++){
+        if(!sel[i]){
+            continue;
+        }
+
+        //Use -PID so the signal reaches every process in the job.
+        if(kill(-(jobs[i].pid), sig) < 0){
+            printf("%s: (%d): %s\n", argv[0], jobs[i].pid, strerror(errno));
+            last_status = 1;
+            continue;
+        }
+
+        //A continued job keeps running in the bg.
+        trace('i', "signal", jobs[i].pid, "signal", sig);
+        if(sig == SIGCONT && jobs[i].state == ST){
+            tracestate(&jobs[i], BG);
+            jobs[i].state = BG;
+            statjob(&jobs[i]);
+        }
 
-        //Now that the job is running in the bg, print out the bg job details.
-        printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+        //A supervised job that is killed on purpose is not restarted.
+        if(sig == SIGKILL || sig == SIGTERM || sig == SIGINT || sig == SIGHUP || sig == SIGQUIT){
+            jobs[i].restart = RESTART_NONE;
+        }
+    }
+    for(i = 0; i < nothers; i++){
+        if(kill(others[i], sig) < 0){
+            printf("%s: (%d): %s\n", argv[0], others[i], strerror(errno));
+            last_status = 1;
+        }
     }
-    else{//Set the job's status to running in the fg.
-        job->state= FG;
 
-        //Now that the job is running in the fg, must wait until it is finshed.
-        waitfg(job->pid);
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (do_kill)");
     }
 
     return;
 }
 
 /*
- * waitfg - Block until process pid is no longer the foreground process
+ * do_disown - Execute the builtin disown command. Selected jobs are
+ *    removed from the job list and left running.
  */
-void waitfg(pid_t pid){
-    //Don't want to use waitpid here; creates a mess.
-    // int status;
-    // if(waitpid(pid, &status, 0) < 0){ //Parent waits for child process (a fg job) to end.
-    //     unix_error("waitfg: waitpid error"); //Catch error
-    // }
+void do_disown(char **argv){
+    int sel[MAXJOBS]; //sel[i] is true if jobs[i] was named on the command line.
+    int i;
+    sigset_t mask, prev;
 
-    //While fg job is still active.
-    while (fgpid(jobs) != 0){
-        //Continue to sleep until fg is no longer active.
-        sleep(1);
+    if(argv[1] == NULL){
+        printf("%s command requires PID or %%jobid argument\n", argv[0]);
+        last_status = 1;
+        return;
+    }
+
+    //Keep the reaper out of the job list while it is being walked.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (do_disown)");
+    }
+
+    if(selectjobs(argv[0], argv + 1, sel, NULL, NULL) > 0){
+        for(i = 0; i < MAXJOBS; i++){
+            if(sel[i]){
+                deletejob(jobs, jobs[i].pid);
+            }
+        }
+    }
+
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (do_disown)");
     }
 
     return;
 }
 
-/*****************
- * Signal handlers
- *****************/
+/*
+ * do_source - Execute the builtin source command. The script is
+ *    compiled on first use and rerun from the cache until its file
+ *    changes.
+ */
+void do_source(char **argv){
+    struct script_t *script;
+
+    //Source command requires a file argument.
+    if(argv[1] == NULL){
+        printf("%s command requires a file argument\n", argv[0]);
+        last_status = 1;
+        return;
+    }
+
+    //Stop a script that keeps sourcing itself.
+    if(sourcedepth >= MAXDEPTH){
+        printf("%s: %s: nested too deeply\n", argv[0], argv[1]);
+        last_status = 1;
+        return;
+    }
+
+    //Find the compiled script, compiling it if needed.
+    if((script = loadscript(argv[1])) == NULL){
+        last_status = 1;
+        return;
+    }
+
+    //Mark the script busy so a nested source can't evict it while it runs.
+    script->busy++;
+    sourcedepth++;
+    runscript(script);
+    sourcedepth--;
+    script->busy--;
+
+    //A script that did not fit in the cache is thrown away after the run.
+    if(!script->cached){
+        freescript(script);
+        free(script);
+    }
+
+    return;
+}
 
 /*
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.
+ * do_supervise - Execute the builtin supervise command:
+ *    supervise [--restart=always|on-failure] [--backoff=N[ms|s]] cmd...
+ *    The command runs as a bg job that sigchld_handler restarts after
+ *    it exits, waiting N ms (default BACKOFF) before the first restart
+ *    and twice as long before each one after that. The redirections
+ *    are applied to the job every time it is started.
  */
-void sigchld_handler(int sig){
-    int status = 0;
+void do_supervise(char **argv, struct redir_t *redirs, int nredirs){
+    int restart = RESTART_ALWAYS, backoff = BACKOFF;
+    char cmdline[MAXLINE]; //Command line for the job list.
+    char **cmd, *end;
+    struct job_t *job;
     pid_t pid;
+    int i, n, len = 0;
+    sigset_t mask, prev;
 
-    //Reap all available zombie children or handle stopped children.
-    //If none of the children have terminated OR none of the children are stopped (pid = 0), exit loop.
-    while ((pid = waitpid(-1, &status, WNOHANG|WUNTRACED)) != 0){
-        if(pid < 0){
-            //If waitpid returns a negative value, it has no child processes at all.
+    //Options come before the command.
+    for(cmd = argv + 1; *cmd != NULL && strncmp(*cmd, "--", 2) == 0; cmd++){
+        if(strcmp(*cmd, "--restart=always") == 0){
+            restart = RESTART_ALWAYS;
+        }
+        else if(strcmp(*cmd, "--restart=on-failure") == 0){
+            restart = RESTART_FAIL;
+        }
+        else if(strncmp(*cmd, "--backoff=", 10) == 0){
+            backoff = strtol(*cmd + 10, &end, 10);
+            if(strcmp(end, "s") == 0){
+                backoff *= 1000;
+            }
+            else if(*end != '\0' && strcmp(end, "ms") != 0){
+                backoff = -1;
+            }
+            if(backoff < 0 || backoff > MAXBACKOFF){
+                printf("%s: invalid backoff: %s\n", argv[0], *cmd + 10);
+                last_status = 1;
+                return;
+            }
+        }
+        else{
+            printf("%s: unknown option: %s\n", argv[0], *cmd);
+            last_status = 1;
             return;
         }
+    }
+    if(*cmd == NULL){
+        printf("%s command requires a command argument\n", argv[0]);
+        last_status = 1;
+        return;
+    }
 
-        //Remove terminated job or edit status of stopped job.
-        if(pid > 0){
+    //The redirections are kept with the job, so they have to fit.
+    for(i = 0, n = 0; i < nredirs; i++){
+        if(redirs[i].arg != NULL){
+            n += strlen(redirs[i].arg) + 1;
+        }
+    }
+    if(n > MAXLINE){
+        printf("%s: redirections are too long to keep\n", argv[0]);
+        last_status = 1;
+        return;
+    }
 
-            //If the child process did not terminate normally through an exit or return, give reason.
-            if(!WIFEXITED(status)){
-                //If the process was terminated by a signal that was not caught, report the signal.
-                if(WIFSIGNALED(status)){
-                    printf("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid), pid, WTERMSIG(status));
-                }
-            }
+    //The job list shows the whole supervise command line.
+    for(i = 0; argv[i] != NULL && len < MAXLINE - 2; i++){
+        len += snprintf(cmdline + len, MAXLINE - 1 - len, "%s%s", i ? " " : "", argv[i]);
+    }
+    strcpy(cmdline + (len < MAXLINE - 2 ? len : MAXLINE - 2), "\n");
 
-            //If the child is stopped, don't remove it from the job list, but change its state to stopped (ST).
-            if(WIFSTOPPED(status)){
-                //Find the stopped job with its PID and change its state.
-                getjobpid(jobs, pid)->state = ST;
+    //Keep the reaper away until the restart policy is in place.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (do_supervise)");
+    }
 
-                //Report that the job was stopped and by what sign.
-                printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid), pid, WSTOPSIG(status));
+    pid = launch(cmd, 1, cmdline, redirs, nredirs, &deflimits);
+    if((job = getjobpid(jobs, pid)) != NULL){
+        job->restart = restart;
+        job->backoff = job->delay = backoff;
+
+        //Save the arguments so the job can be started again.
+        for(i = 0, len = 0; cmd[i] != NULL; i++){
+            n = strlen(cmd[i]) + 1;
+            if(len + n > MAXLINE){
+                break;
             }
-            else{
-                //When a child has been reaped, delete its job from the job list.
-                deletejob(jobs, pid);
+            memcpy(job->args + len, cmd[i], n);
+            len += n;
+        }
+        job->argc = i;
+
+        //Save the redirections for the same reason.
+        for(i = 0, len = 0; i < nredirs; i++){
+            job->redirs[i] = redirs[i];
+            if(redirs[i].arg != NULL){
+                job->redirs[i].arg = strcpy(job->redirargs + len, redirs[i].arg);
+                len += strlen(redirs[i].arg) + 1;
             }
         }
+        job->nredirs = nredirs;
+    }
+
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (do_supervise)");
     }
 
     return;
 }
 
 /*
- * sigint_handler - The kernel sends a SIGINT to the shell whenever the
- *    user types ctrl-c at the keyboard.  Catch it and send it along
- *    to the foreground job.
+ * do_limit - Execute the builtin limit command: limit [name=value...]
+ *    Without settings it shows the limits every new job gets, otherwise
+ *    it changes them. name is as (bytes), cpu (seconds), nofile or
+ *    nproc; value is a number with an optional k, m or g suffix,
+ *    "unlimited", or empty to drop the limit. "limit name=value... cmd"
+ *    is handled by runargv and limits just that command.
  */
-void sigint_handler(int sig){
-    //Get the fg job pid, if there is a fg job.
-    pid_t pid = fgpid(jobs);
-
-    //If pid = 0, then there is no running fg to terminate.
-    if(pid != 0){
-        //Send SIGINT signal to every process in the fg group.
-        if(kill(-pid, sig) < 0){
-            //If kill returns a negative value, an error occurred.
-            unix_error("kill error (sigint_handler)");
+void do_limit(char **argv){
+    char buf[32];
+    int i, n;
+
+    //Any settings change the defaults.
+    for(n = 0; argv[n + 1] != NULL; n++)
+        ;
+    if(n > 0){
+        if(parselimits(argv[0], argv + 1, n, &deflimits) < 0){
+            last_status = 1;
+        }
+        return;
+    }
+
+    for(i = 0; i < NLIMITS; i++){
+        printf("%-6s %s\n", limitnames[i], (deflimits.set & (1 << i)) ? fmtlimit(deflimits.rlim[i], buf) : "-");
+    }
+
+    return;
+}
+
+/*
+ * do_prlimit - Execute the builtin prlimit command:
+ *    prlimit spec... [name=value...]
+ *    Without settings it shows each selected job's limits. Otherwise
+ *    the limits are set on every process in each selected job, and a
+ *    supervised job keeps them when it is restarted.
+ */
+void do_prlimit(char **argv){
+    int sel[MAXJOBS]; //sel[i] is true if jobs[i] was named on the command line.
+    char *specs[MAXARGS]; //The job specs, without the settings.
+    char **settings;
+    struct limits_t lim; //The limits to set.
+    struct rlimit rl;
+    char cur[32], max[32];
+    int i, j, n, nspecs = 0;
+    sigset_t mask, prev;
+
+    //Job specs come first, then the settings.
+    for(n = 1; argv[n] != NULL && strchr(argv[n], '=') == NULL; n++){
+        specs[nspecs++] = argv[n];
+    }
+    specs[nspecs] = NULL;
+    settings = argv + n;
+    for(n = 0; settings[n] != NULL; n++)
+        ;
+    if(nspecs == 0){
+        printf("%s command requires PID or %%jobid argument\n", argv[0]);
+        last_status = 1;
+        return;
+    }
+    lim.set = 0;
+    if(parselimits(argv[0], settings, n, &lim) < 0){
+        last_status = 1;
+        return;
+    }
+
+    //Keep the reaper out of the job list while it is being walked.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (do_prlimit)");
+    }
+
+    if(selectjobs(argv[0], specs, sel, NULL, NULL) < 0){
+        last_status = 1;
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        return;
+    }
+
+    for(i = 0; i < MAXJOBS; i++){
+        if(!sel[i]){
+            continue;
+        }
+
+        //Show the limits the job's leader has now, soft:hard where they differ.
+        if(n == 0){
+            printf("[%d] (%d)", jobs[i].jid, jobs[i].pid);
+            for(j = 0; j < NLIMITS; j++){
+                if(prlimit(jobs[i].pid, limitres[j], NULL, &rl) < 0){
+                    printf(" %s=?", limitnames[j]);
+                }
+                else if(rl.rlim_cur == rl.rlim_max){
+                    printf(" %s=%s", limitnames[j], fmtlimit(rl.rlim_cur, cur));
+                }
+                else{
+                    printf(" %s=%s:%s", limitnames[j], fmtlimit(rl.rlim_cur, cur), fmtlimit(rl.rlim_max, max));
+                }
+            }
+            printf("\n");
+            continue;
+        }
+
+        for(j = 0; j < NLIMITS; j++){
+            if(!(lim.set & (1 << j))){
+                continue;
+            }
+            mkrlimit(j, lim.rlim[j], &rl);
+            if(prlimitgroup(jobs[i].pid, limitres[j], &rl) < 0){
+                printf("%s: (%d): %s: %s\n", argv[0], jobs[i].pid, limitnames[j], strerror(errno));
+                last_status = 1;
+                continue;
+            }
+            jobs[i].limits.set |= 1 << j;
+            jobs[i].limits.rlim[j] = lim.rlim[j];
+        }
+    }
+
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (do_prlimit)");
+    }
+
+    return;
+}
+
+/*
+ * waitfg - Block until process pid is no longer the foreground process
+ */
+void waitfg(pid_t pid){
+    sigset_t mask, prev;
+
+    //Block SIGCHLD while checking the job list so the reap can't slip in
+    //between the check and the suspend. Sleeping in 1 second chunks here
+    //would cost every fg command in a script loop up to a second.
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (waitfg)");
+    }
+
+    //While fg job is still active, wait for the next signal.
+    while (fgpid(jobs) != 0){
+        sigsuspend(&prev);
+    }
+
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (waitfg)");
+    }
+
+    return;
+}
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/*
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
+ *     available zombie children, but doesn't wait for any other
+ *     currently running children to terminate. With -R the shell is a
+ *     child subreaper, so orphaned descendants of a job are reparented
+ *     to it and reaped here too; they belong to the job whose process
+ *     group they are in, and the job ends when the last of them does.
+ */
+void sigchld_handler(int sig){
+    int status = 0;
+    pid_t pid;
+    struct job_t *job;
+    struct rusage ru; //What the child used, to tell if a limit killed it.
+    siginfo_t info; //The next child to reap, looked at before it is reaped.
+    pid_t pgid = 0; //Process group of the child, once it is known.
+    char *limit;
+
+    //Reap all available zombie children or handle stopped children.
+    //If none of the children have terminated OR none of the children are stopped (pid = 0), exit loop.
+    while (1){
+        //An orphan's process group is gone once it is reaped, so look it up first.
+        if(subreaper){
+            info.si_pid = 0;
+            if(waitid(P_ALL, 0, &info, WEXITED|WSTOPPED|WNOHANG|WNOWAIT) < 0 || info.si_pid == 0){
+                return;
+            }
+            pgid = getpgid(info.si_pid);
+            pid = wait4(info.si_pid, &status, WNOHANG|WUNTRACED, &ru);
+        }
+        else{
+            pid = wait4(-1, &status, WNOHANG|WUNTRACED, &ru);
+        }
+        if(pid == 0){
+            break;
+        }
+        if(pid < 0){
+            //If waitpid returns a negative value, it has no child processes at all.
+            return;
+        }
+
+        //Remove terminated job or edit status of stopped job.
+        if(pid > 0){
+
+            //Processes that were disowned are reaped quietly, and so are
+            //orphans that don't belong to any job.
+            if((job = getjobpid(jobs, pid)) == NULL && (!subreaper || (job = getjobpid(jobs, pgid)) == NULL)){
+                continue;
+            }
+
+            //Keep the CPU time of the job's processes that are gone.
+            if(!WIFSTOPPED(status)){
+                job->cpu += ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec
+                    + ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+            }
+
+            //In subreaper mode a job is done only when its process group is empty.
+            if(subreaper && !WIFSTOPPED(status) && kill(-job->pid, 0) == 0){
+                if(pid == job->pid){
+                    //The leader is gone but the rest of its tree still runs.
+                    job->leaderstatus = status;
+                }
+                statjob(job);
+                continue;
+            }
+            if(subreaper && pid != job->pid){
+                //While the leader is alive only its stops count. Once it is
+                //gone a descendant's stop stops the job, or an fg job whose
+                //tree is all stopped would keep waitfg waiting forever. When
+                //the last descendant exits, the job ends the way its leader did.
+                if(job->leaderstatus == -1){
+                    statjob(job);
+                    continue;
+                }
+                if(!WIFSTOPPED(status)){
+                    status = job->leaderstatus;
+                }
+                pid = job->pid;
+            }
+
+            //Record how the fg job ended so scripts can test it.
+            if(job->state == FG){
+                if(WIFEXITED(status)){
+                    last_status = WEXITSTATUS(status);
+                }
+                else if(WIFSIGNALED(status)){
+                    last_status = 128 + WTERMSIG(status);
+                }
+                else if(WIFSTOPPED(status)){
+                    last_status = 128 + WSTOPSIG(status);
+                }
+            }
+
+            //If the child process did not terminate normally through an exit or return, give reason.
+            if(!WIFEXITED(status)){
+                //If the process was terminated by a signal that was not caught, report the signal.
+                if(WIFSIGNALED(status)){
+                    if((limit = limitkill(job, status, &ru)) != NULL){
+                        printf("Job [%d] (%d) terminated by signal %d (%s limit)\n", pid2jid(pid), pid, WTERMSIG(status), limit);
+                    }
+                    else{
+                        printf("Job [%d] (%d) terminated by signal %d\n", pid2jid(pid), pid, WTERMSIG(status));
+                    }
+                }
+            }
+
+            if(!WIFSTOPPED(status)){
+                trace('i', "reap", pid, "status", status);
+            }
+
+            //If the child is stopped, don't remove it from the job list, but change its state to stopped (ST).
+            if(WIFSTOPPED(status)){
+                //Change the stopped job's state.
+                tracestate(job, ST);
+                job->state = ST;
+                statjob(job);
+
+                //Report that the job was stopped and by what sign.
+                printf("Job [%d] (%d) stopped by signal %d\n", pid2jid(pid), pid, WSTOPSIG(status));
+            }
+            else if(job->restart == RESTART_ALWAYS
+                    || (job->restart == RESTART_FAIL && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))){
+                //A supervised job is started again instead of being deleted.
+                restartjob(job, status);
+            }
+            else{
+                //When a child has been reaped, delete its job from the job list.
+                deletejob(jobs, pid);
+            }
+        }
+    }
+
+    return;
+}
+
+/*
+ * sigint_handler - The kernel sends a SIGINT to the shell whenever the
+ *    user types ctrl-c at the keyboard.  Catch it and send it along
+ *    to the foreground job.
+ */
+void sigint_handler(int sig){
+    //Get the fg job pid, if there is a fg job.
+    pid_t pid = fgpid(jobs);
+
+    //If pid = 0, then there is no running fg to terminate.
+    if(pid != 0){
+        //A job the user interrupts stays down even if it is supervised.
+        getjobpid(jobs, pid)->restart = RESTART_NONE;
+        trace('i', "SIGINT", pid, NULL, 0);
+
+        //Send SIGINT signal to every process in the fg group.
+        if(kill(-pid, sig) < 0){
+            //If kill returns a negative value, an error occurred.
+            unix_error("kill error (sigint_handler)");
         }
     }
 
@@ -521,6 +1464,8 @@ void sigtstp_handler(int sig){
 
     //If pid = 0, then there is no running fg to stop.
     if(pid != 0){
+        trace('i', "SIGTSTP", pid, NULL, 0);
+
         //Send SIGTSTP signal to every process in the fg group.
         if(kill(-pid, sig) < 0){
             //If kill returns a negative value, an error occurred.
@@ -545,6 +1490,14 @@ void clearjob(struct job_t *job){
     job->jid = 0;
     job->state = UNDEF;
     job->cmdline[0] = '\0';
+    job->restart = RESTART_NONE;
+    job->restarts = 0;
+    job->lastexit = -1;
+    job->argc = 0;
+    job->nredirs = 0;
+    job->limits.set = 0;
+    job->cpu = 0;
+    job->leaderstatus = -1;
 }
 
 /* initjobs - Initialize the job list */
@@ -575,11 +1528,15 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline){
     for (i = 0; i < MAXJOBS; i++) {
     	if (jobs[i].pid == 0) {
     	    jobs[i].pid = pid;
-    	    jobs[i].state = state;
     	    jobs[i].jid = nextjid++;
     	    if (nextjid > MAXJOBS)
     		nextjid = 1;
     	    strcpy(jobs[i].cmdline, cmdline);
+    	    clock_gettime(CLOCK_MONOTONIC, &jobs[i].started);
+    	    tracename(pid, jobs[i].jid, cmdline);
+    	    tracestate(&jobs[i], state);
+    	    jobs[i].state = state;
+    	    statjob(&jobs[i]);
       	    if(verbose){
     	        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid, jobs[i].cmdline);
                 }
@@ -599,7 +1556,9 @@ int deletejob(struct job_t *jobs, pid_t pid){
 
     for (i = 0; i < MAXJOBS; i++) {
     	if (jobs[i].pid == pid) {
+    	    tracestate(&jobs[i], UNDEF);
     	    clearjob(&jobs[i]);
+    	    statjob(&jobs[i]);
     	    nextjid = maxjid(jobs)+1;
     	    return 1;
     	}
@@ -659,6 +1618,85 @@ int pid2jid(pid_t pid){
     return 0;
 }
 
+/*
+ * restartjob - Start a supervised job again after it exited with the
+ *    given wait status. Called from sigchld_handler. Like the rest of
+ *    the handler it updates the job list, the trace and the status page,
+ *    which is safe because the shell blocks SIGCHLD wherever it changes
+ *    them. The printf calls on the verbose and fork failure paths are
+ *    not async-signal-safe, as elsewhere in the handler. The new child
+ *    waits out the backoff itself before exec'ing, so no timer or extra
+ *    process is needed.
+ */
+void restartjob(struct job_t *job, int status){
+    char *argv[MAXARGS];
+    struct timespec now, wait;
+    sigset_t empty;
+    long ran;
+    pid_t pid;
+    int i, off;
+
+    for (i = off = 0; i < job->argc && i < MAXARGS - 1; i++) {
+	argv[i] = job->args + off;
+	off += strlen(argv[i]) + 1;
+    }
+    argv[i] = NULL;
+
+    /* a job that stayed up for a while starts over at the base delay */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ran = (now.tv_sec - job->started.tv_sec) * 1000
+	+ (now.tv_nsec - job->started.tv_nsec) / 1000000;
+    if (ran >= RESETRUN)
+	job->delay = job->backoff;
+    wait.tv_sec = job->delay / 1000;
+    wait.tv_nsec = (job->delay % 1000) * 1000000L;
+
+    if ((pid = fork()) < 0) {
+	printf("Job [%d] (%d) could not be restarted: %s\n", job->jid, job->pid, strerror(errno));
+	deletejob(jobs, job->pid);
+	return;
+    }
+    if (pid == 0) {
+	/* the child must not run the shell's handlers while it waits */
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTSTP, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+	setpgid(0, 0);
+	while (nanosleep(&wait, &wait) < 0 && errno == EINTR)
+	    ;
+	if (applyredirs(job->redirs, job->nredirs, 1) < 0 || applylimits(&job->limits) < 0)
+	    exit(1);
+	execve(argv[0], argv, environ);
+	printf("%s: Command not found\n", argv[0]);
+	exit(127);
+    }
+    setpgid(pid, pid);
+
+    if (verbose)
+	printf("Job [%d] (%d) restarting as (%d) in %d ms\n", job->jid, job->pid, pid, job->delay);
+    tracestate(job, UNDEF);
+    tracename(pid, job->jid, job->cmdline);
+    job->pid = pid;
+    job->state = UNDEF;
+    tracestate(job, BG);
+    job->state = BG;
+    job->lastexit = status;
+    job->leaderstatus = -1;
+    job->restarts++;
+    job->started = now;
+    job->started.tv_sec += job->delay / 1000;
+    job->started.tv_nsec += (job->delay % 1000) * 1000000L;
+    if (job->started.tv_nsec >= 1000000000L) {
+	job->started.tv_sec++;
+	job->started.tv_nsec -= 1000000000L;
+    }
+    job->delay = (job->delay * 2 > MAXBACKOFF) ? MAXBACKOFF : job->delay * 2;
+    statjob(job);
+}
+
 /* listjobs - Print the job list */
 void listjobs(struct job_t *jobs){
     int i;
@@ -679,15 +1717,1298 @@ void listjobs(struct job_t *jobs){
     	    default:
     		    printf("listjobs: Internal error: job[%d].state=%d ", i, jobs[i].state);
     	    }
-    	    printf("%s", jobs[i].cmdline);
+    	    if (jobs[i].restart == RESTART_NONE && jobs[i].restarts == 0) {
+    		printf("%s", jobs[i].cmdline);
+    		continue;
+    	    }
+
+    	    /* supervised jobs also show restarts and the last exit */
+    	    printf("%.*s (restarts %d", (int)strcspn(jobs[i].cmdline, "\n"),
+    		   jobs[i].cmdline, jobs[i].restarts);
+    	    if (jobs[i].lastexit == -1)
+    		printf(")\n");
+    	    else if (WIFSIGNALED(jobs[i].lastexit))
+    		printf(", last killed by signal %d)\n", WTERMSIG(jobs[i].lastexit));
+    	    else
+    		printf(", last exit %d)\n", WEXITSTATUS(jobs[i].lastexit));
     	}
     }
 }
+/*
+ * selectjobs - Mark sel[i] for every job named by the NULL terminated
+ *    list of job specs. A spec is one of
+ *        PID          the job with that PID
+ *        %jid         the job with that job ID
+ *        %jid-%jid    every job in that range of job IDs
+ *        %?text       every job whose command line contains text
+ *        %running     every bg job
+ *        %stopped     every stopped job
+ *        %all         every job
+ *    Specs that match nothing are reported and skipped. If others is
+ *    not NULL, PIDs that aren't jobs are stored there instead. Return
+ *    the number of jobs selected, or -1 after reporting a bad spec.
+ */
+int selectjobs(char *cmd, char **specs, int *sel, pid_t *others, int *nothers){
+    int i, lo, hi, found, n = 0;
+    char *spec, *end;
+    pid_t pid;
+
+    for (i = 0; i < MAXJOBS; i++)
+	sel[i] = 0;
+
+    for (; *specs != NULL; specs++) {
+	spec = *specs;
+	found = 0;
+
+	if (spec[0] != '%') {
+	    /* PID */
+	    pid = strtol(spec, &end, 10);
+	    if (pid <= 0 || *end != '\0') {
+		printf("%s: argument must be a PID or %%jobid\n", cmd);
+		return -1;
+	    }
+	    for (i = 0; i < MAXJOBS; i++)
+		if (jobs[i].pid == pid)
+		    found = sel[i] = 1;
+	    if (!found && others != NULL) {
+		others[(*nothers)++] = pid;
+		continue;
+	    }
+	    if (!found)
+		printf("(%d): No such process\n", pid);
+	}
+	else {
+	    if (spec[1] == '?') {
+		/* command line contains text */
+		for (i = 0; i < MAXJOBS; i++)
+		    if (jobs[i].pid != 0 && strstr(jobs[i].cmdline, spec + 2) != NULL)
+			found = sel[i] = 1;
+	    }
+	    else if (strcmp(spec, "%running") == 0 || strcmp(spec, "%stopped") == 0
+		     || strcmp(spec, "%all") == 0) {
+		/* every job in a state */
+		for (i = 0; i < MAXJOBS; i++)
+		    if (jobs[i].pid != 0 && (spec[1] == 'a'
+			|| jobs[i].state == (spec[1] == 'r' ? BG : ST)))
+			found = sel[i] = 1;
+	    }
+	    else {
+		/* %jid or %jid-%jid */
+		lo = hi = strtol(spec + 1, &end, 10);
+		if (*end == '-')
+		    hi = strtol(end + 1 + (end[1] == '%'), &end, 10);
+		if (lo <= 0 || hi < lo || *end != '\0') {
+		    printf("%s: argument must be a PID or %%jobid\n", cmd);
+		    return -1;
+		}
+		for (i = 0; i < MAXJOBS; i++)
+		    if (jobs[i].jid >= lo && jobs[i].jid <= hi)
+			found = sel[i] = 1;
+	    }
+	    if (!found)
+		printf("%s: No such job\n", spec);
+	}
+    }
+
+    for (i = 0; i < MAXJOBS; i++)
+	n += sel[i];
+    return n;
+}
 /******************************
  * end job list helper routines
  ******************************/
 
 
+/*********************************************
+ * Helper routines that compile and run scripts
+ *********************************************/
+
+/* grow - Make sure a dynamic array has room for need elements */
+void *grow(void *arr, int need, int *cap, size_t size){
+    if(need <= *cap)
+        return arr;
+
+    while(*cap < need)
+        *cap = (*cap == 0) ? 16 : *cap * 2;
+    if((arr = realloc(arr, *cap * size)) == NULL)
+        unix_error("realloc error");
+    return arr;
+}
+
+/* lookupvar - Return the slot of a variable, creating it if needed */
+int lookupvar(const char *name, int len){
+    int i;
+
+    for(i = 0; i < nvars; i++)
+        if(strncmp(vars[i].name, name, len) == 0 && vars[i].name[len] == '\0')
+            return i;
+
+    if(nvars == MAXVARS || len >= MAXVARNAME)
+        return -1;
+    memcpy(vars[nvars].name, name, len);
+    vars[nvars].name[len] = '\0';
+    vars[nvars].value[0] = '\0';
+    return nvars++;
+}
+
+/* emitinsn - Append an instruction to a script, return its index */
+int emitinsn(struct script_t *s, int op, int a, int b){
+    s->code = grow(s->code, s->ncode + 1, &s->capcode, sizeof(struct insn_t));
+    s->code[s->ncode].op = op;
+    s->code[s->ncode].a = a;
+    s->code[s->ncode].b = b;
+    return s->ncode++;
+}
+
+/*
+ * compilewords - Store a NULL terminated argv list as words, splitting
+ *    each one into literal text and $name references. Return the
+ *    index of the first word, or -1 if there are too many variables.
+ */
+int compilewords(struct script_t *s, char **argv){
+    int first = s->nwords;
+    char *p, *q;
+    int var;
+
+    for(; *argv != NULL; argv++){
+        s->words = grow(s->words, s->nwords + 1, &s->capwords, sizeof(struct word_t));
+        s->words[s->nwords].seg = s->nsegs;
+        s->words[s->nwords].nseg = 0;
+
+        for(p = *argv; *p != '\0'; p = q){
+            s->segs = grow(s->segs, s->nsegs + 1, &s->capsegs, sizeof(struct seg_t));
+
+            if(p[0] == '$' && (isalpha((unsigned char)p[1]) || p[1] == '_')){
+                //Variable reference: $name
+                for(q = p + 1; isalnum((unsigned char)*q) || *q == '_'; q++)
+                    ;
+                if((var = lookupvar(p + 1, q - p - 1)) < 0)
+                    return -1;
+                s->segs[s->nsegs].off = 0;
+                s->segs[s->nsegs].var = var;
+            }
+            else{
+                //Literal text up to the next variable reference.
+                for(q = p + 1; *q != '\0' && !(q[0] == '$' && (isalpha((unsigned char)q[1]) || q[1] == '_')); q++)
+                    ;
+                s->pool = grow(s->pool, s->npool + (q - p) + 1, &s->cappool, 1);
+                memcpy(s->pool + s->npool, p, q - p);
+                s->pool[s->npool + (q - p)] = '\0';
+                s->segs[s->nsegs].off = s->npool;
+                s->segs[s->nsegs].var = -1;
+                s->npool += (q - p) + 1;
+            }
+            s->nsegs++;
+            s->words[s->nwords].nseg++;
+        }
+        s->nwords++;
+    }
+    return first;
+}
+
+/*
+ * compilecmd - Emit an instruction that runs argv with the redirections
+ *    parseredirs took out of it. The redirection targets are kept as
+ *    words so they can use variables, but the operators are fixed here
+ *    and never come from a variable's value. Return -1 on error.
+ */
+int compilecmd(struct script_t *s, char **argv, int bg, struct redir_t *redirs, int nredirs){
+    char *target[2] = {NULL, NULL};
+    int argc, word, i;
+
+    for(argc = 0; argv[argc] != NULL; argc++)
+        ;
+    if((word = compilewords(s, argv)) < 0)
+        return -1;
+
+    s->redirs = grow(s->redirs, s->nredirs + nredirs, &s->capredirs, sizeof(struct sredir_t));
+    for(i = 0; i < nredirs; i++){
+        s->redirs[s->nredirs + i].op = redirs[i].op;
+        s->redirs[s->nredirs + i].fd = redirs[i].fd;
+        s->redirs[s->nredirs + i].fd2 = redirs[i].fd2;
+        s->redirs[s->nredirs + i].newline = redirs[i].newline;
+        s->redirs[s->nredirs + i].word = -1;
+        if(redirs[i].op != R_DUP){
+            target[0] = redirs[i].arg;
+            if((s->redirs[s->nredirs + i].word = compilewords(s, target)) < 0)
+                return -1;
+        }
+    }
+
+    s->cmds = grow(s->cmds, s->ncmds + 1, &s->capcmds, sizeof(struct scmd_t));
+    s->cmds[s->ncmds].word = word;
+    s->cmds[s->ncmds].argc = argc;
+    s->cmds[s->ncmds].bg = bg;
+    s->cmds[s->ncmds].redir = s->nredirs;
+    s->cmds[s->ncmds].nredirs = nredirs;
+    s->nredirs += nredirs;
+    emitinsn(s, OP_RUN, s->ncmds++, 0);
+    return 0;
+}
+
+/*
+ * compileblock - Compile script lines until a line that ends the
+ *    current block. Return the KW_ code of that line, KW_EOF at the end
+ *    of the file, or KW_ERROR after printing a syntax error.
+ *
+ *    if cmd / [then] / ... / [else / ...] / fi
+ *    while cmd / [do] / ... / done
+ *    for name in word... / [do] / ... / done
+ */
+int compileblock(struct script_t *s, FILE *fp, int *lineno){
+    char line[MAXLINE];   /* one line of the script */
+    char *argv[MAXARGS];  /* the line split into words */
+    char quoted[MAXARGS]; /* which words were in quotes */
+    struct redir_t redirs[MAXREDIRS]; /* redirections of the line's command */
+    static char heredoc[MAXHERE + 4]; /* "<<<" and the body of a here-document */
+    char *p;
+    int bg, kw, top, jump, end, loop, word, var, n, i, cmd, nredirs;
+
+    while(fgets(line, MAXLINE - 1, fp) != NULL){
+        (*lineno)++;
+
+        //parseline expects the line to end in a newline.
+        n = strlen(line);
+        if(n == 0 || line[n-1] != '\n'){
+            if(!feof(fp)){
+                printf("%s: line %d: line too long\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            line[n] = '\n';
+            line[n+1] = '\0';
+        }
+
+        bg = parseline(line, argv, quoted);
+
+        //Skip blank lines, comments and the optional then/do lines.
+        if(argv[0] == NULL || argv[0][0] == '#'){
+            continue;
+        }
+        if(strcmp(argv[0], "then") == 0 || strcmp(argv[0], "do") == 0){
+            continue;
+        }
+
+        //Read a here-document now and keep it in the script as a here-string.
+        for(i = 0; argv[i] != NULL; i++){
+            if(quoted[i] || strncmp(argv[i], "<<", 2) != 0 || argv[i][2] == '<'){
+                continue;
+            }
+            if(argv[i][2] == '\0'){
+                //"<< EOF": the delimiter is the next word.
+                for(n = i + 1; argv[n] != NULL; n++){
+                    argv[n-1] = argv[n];
+                    quoted[n-1] = quoted[n];
+                }
+                argv[n-1] = NULL;
+            }
+            else{
+                argv[i] += 2;
+            }
+            if(argv[i] == NULL){
+                printf("%s: line %d: << requires a delimiter\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+
+            strcpy(heredoc, "<<<");
+            if((n = readheredoc(fp, argv[i], heredoc + 3, MAXHERE)) < 0){
+                printf("%s: line %d: here-document too large\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+
+            //The here-string adds back the last newline.
+            for(p = heredoc + 3; *p != '\0'; p++){
+                *lineno += (*p == '\n');
+            }
+            (*lineno)++;
+            if(n > 0 && heredoc[n+2] == '\n'){
+                heredoc[n+2] = '\0';
+            }
+            argv[i] = heredoc;
+            quoted[i] = 0;
+            break;
+        }
+
+        //Take the redirections out of the command while the words are
+        //still as written, so quoted words and variables are never operators.
+        nredirs = 0;
+        cmd = (strcmp(argv[0], "if") == 0 || strcmp(argv[0], "while") == 0);
+        if(strcmp(argv[0], "for") != 0 && argv[cmd] != NULL
+           && (nredirs = parseredirs(argv + cmd, quoted + cmd, redirs, NULL, NULL)) < 0){
+            printf("%s: line %d: bad redirection\n", s->path, *lineno);
+            return KW_ERROR;
+        }
+
+        if(strcmp(argv[0], "else") == 0){
+            return KW_ELSE;
+        }
+        else if(strcmp(argv[0], "fi") == 0){
+            return KW_FI;
+        }
+        else if(strcmp(argv[0], "done") == 0){
+            return KW_DONE;
+        }
+        else if(strcmp(argv[0], "if") == 0){
+            //cond; JFALSE else; then-part; JUMP end; else: else-part; end:
+            if(argv[1] == NULL){
+                printf("%s: line %d: if requires a command\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            if(compilecmd(s, argv + 1, bg, redirs, nredirs) < 0){
+                printf("%s: line %d: too many variables\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            jump = emitinsn(s, OP_JFALSE, 0, 0);
+
+            if((kw = compileblock(s, fp, lineno)) == KW_ERROR){
+                return KW_ERROR;
+            }
+            if(kw == KW_ELSE){
+                end = emitinsn(s, OP_JUMP, 0, 0);
+                s->code[jump].b = s->ncode;
+                jump = end;
+                if((kw = compileblock(s, fp, lineno)) == KW_ERROR){
+                    return KW_ERROR;
+                }
+            }
+            if(kw != KW_FI){
+                printf("%s: line %d: expected fi\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            s->code[jump].b = s->ncode;
+        }
+        else if(strcmp(argv[0], "while") == 0){
+            //top: cond; JFALSE end; body; JUMP top; end:
+            if(argv[1] == NULL){
+                printf("%s: line %d: while requires a command\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            top = s->ncode;
+            if(compilecmd(s, argv + 1, bg, redirs, nredirs) < 0){
+                printf("%s: line %d: too many variables\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            jump = emitinsn(s, OP_JFALSE, 0, 0);
+
+            if((kw = compileblock(s, fp, lineno)) == KW_ERROR){
+                return KW_ERROR;
+            }
+            if(kw != KW_DONE){
+                printf("%s: line %d: expected done\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            emitinsn(s, OP_JUMP, 0, top);
+            s->code[jump].b = s->ncode;
+        }
+        else if(strcmp(argv[0], "for") == 0){
+            //FORINIT; top: FORNEXT end; body; JUMP top; end:
+            if(argv[1] == NULL || argv[2] == NULL || strcmp(argv[2], "in") != 0){
+                printf("%s: line %d: usage: for name in word...\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            if((var = lookupvar(argv[1], strlen(argv[1]))) < 0 || (word = compilewords(s, argv + 3)) < 0){
+                printf("%s: line %d: too many variables\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+
+            s->loops = grow(s->loops, s->nloops + 1, &s->caploops, sizeof(struct sloop_t));
+            loop = s->nloops++;
+            s->loops[loop].var = var;
+            s->loops[loop].word = word;
+            s->loops[loop].nwords = s->nwords - word;
+
+            emitinsn(s, OP_FORINIT, loop, 0);
+            top = emitinsn(s, OP_FORNEXT, loop, 0);
+
+            if((kw = compileblock(s, fp, lineno)) == KW_ERROR){
+                return KW_ERROR;
+            }
+            if(kw != KW_DONE){
+                printf("%s: line %d: expected done\n", s->path, *lineno);
+                return KW_ERROR;
+            }
+            emitinsn(s, OP_JUMP, 0, top);
+            s->code[top].b = s->ncode;
+        }
+        else if(compilecmd(s, argv, bg, redirs, nredirs) < 0){
+            printf("%s: line %d: too many variables\n", s->path, *lineno);
+            return KW_ERROR;
+        }
+    }
+
+    return KW_EOF;
+}
+
+/* compilescript - Compile the file at path into s, return -1 on error */
+int compilescript(struct script_t *s, const char *path){
+    FILE *fp;
+    int kw, lineno = 0;
+
+    if((fp = fopen(path, "r")) == NULL){
+        printf("%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    strncpy(s->path, path, MAXLINE - 1);
+
+    kw = compileblock(s, fp, &lineno);
+    fclose(fp);
+
+    if(kw == KW_EOF)
+        return 0;
+    if(kw != KW_ERROR)
+        printf("%s: line %d: unexpected %s\n", path, lineno,
+               kw == KW_ELSE ? "else" : kw == KW_FI ? "fi" : "done");
+    return -1;
+}
+
+/* freescript - Release the memory held by a compiled script */
+void freescript(struct script_t *s){
+    free(s->code);
+    free(s->cmds);
+    free(s->redirs);
+    free(s->loops);
+    free(s->words);
+    free(s->segs);
+    free(s->pool);
+    memset(s, 0, sizeof(struct script_t));
+}
+
+/*
+ * loadscript - Return the compiled script for path. A cached copy is
+ *    used as long as the file's mtime hasn't changed. Return NULL if the
+ *    file can't be read or doesn't compile.
+ */
+struct script_t *loadscript(const char *path){
+    struct stat st;
+    struct script_t *s, *victim = NULL;
+    int i;
+
+    if(stat(path, &st) < 0){
+        printf("%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    scriptclock++;
+
+    for(i = 0; i < MAXSCRIPTS; i++){
+        s = &scripts[i];
+        if(s->cached && strcmp(s->path, path) == 0
+           && s->mtime.tv_sec == st.st_mtim.tv_sec && s->mtime.tv_nsec == st.st_mtim.tv_nsec){
+            s->lastuse = scriptclock;
+            return s;
+        }
+    }
+
+    //Pick a free slot, or else the least recently used idle script.
+    for(i = 0; i < MAXSCRIPTS; i++){
+        s = &scripts[i];
+        if(!s->cached){
+            victim = s;
+            break;
+        }
+        if(s->busy == 0 && (victim == NULL || s->lastuse < victim->lastuse))
+            victim = s;
+    }
+
+    if(victim != NULL){
+        freescript(victim);
+        victim->cached = 1;
+    }
+    else if((victim = calloc(1, sizeof(struct script_t))) == NULL){
+        unix_error("calloc error");
+    }
+    victim->mtime = st.st_mtim;
+    victim->lastuse = scriptclock;
+
+    if(compilescript(victim, path) < 0){
+        if(victim->cached){
+            freescript(victim);
+        }
+        else{
+            freescript(victim);
+            free(victim);
+        }
+        return NULL;
+    }
+    return victim;
+}
+
+/*
+ * expandword - Write the value of a word into buf, substituting the
+ *    current value of each variable. Return -1 if it doesn't fit.
+ */
+int expandword(struct script_t *s, struct word_t *w, char *buf, int size){
+    struct seg_t *seg;
+    const char *text;
+    int i, len, n = 0;
+
+    for(i = 0; i < w->nseg; i++){
+        seg = &s->segs[w->seg + i];
+        text = (seg->var < 0) ? s->pool + seg->off : vars[seg->var].value;
+        len = strlen(text);
+        if(n + len >= size)
+            return -1;
+        memcpy(buf + n, text, len);
+        n += len;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/*
+ * runcmd - Run one compiled command through the same builtin and
+ *    launch path that eval uses. The job's command line is rebuilt from
+ *    the expanded words so jobs and bg reports look as usual. The
+ *    redirections were found when the script was compiled; only their
+ *    targets are expanded here.
+ */
+void runcmd(struct script_t *s, struct scmd_t *cmd){
+    char *argv[MAXARGS];   /* expanded arguments */
+    char argbuf[MAXLINE + MAXHERE]; /* storage for the expanded arguments */
+    char cmdline[MAXLINE]; /* command line for the job list */
+    struct redir_t redirs[MAXREDIRS];
+    struct sredir_t *r;
+    int i, n, space, used = 0, len = 0;
+
+    for(i = 0; i < cmd->argc && i < MAXARGS - 1; i++){
+        argv[i] = argbuf + used;
+        if((n = expandword(s, &s->words[cmd->word + i], argv[i], sizeof(argbuf) - used)) < 0){
+            printf("%s: command line too long\n", s->path);
+            last_status = 1;
+            return;
+        }
+        used += n + 1;
+    }
+    argv[i] = NULL;
+
+    for(i = 0; i < cmd->nredirs; i++){
+        r = &s->redirs[cmd->redir + i];
+        redirs[i].op = r->op;
+        redirs[i].fd = r->fd;
+        redirs[i].fd2 = r->fd2;
+        redirs[i].newline = r->newline;
+        redirs[i].arg = NULL;
+        if(r->word < 0)
+            continue;
+        redirs[i].arg = argbuf + used;
+        if((n = expandword(s, &s->words[r->word], redirs[i].arg, sizeof(argbuf) - used)) < 0){
+            printf("%s: command line too long\n", s->path);
+            last_status = 1;
+            return;
+        }
+        used += n + 1;
+    }
+
+    //Join the words back into a command line, cutting it off when it is
+    //full. Room is kept for " &\n" and the NUL.
+    for(i = 0; argv[i] != NULL; i++){
+        if((space = MAXLINE - 4 - len - (i > 0)) <= 0){
+            break;
+        }
+        if((n = strlen(argv[i])) > space){
+            n = space;
+        }
+        if(i > 0)
+            cmdline[len++] = ' ';
+        memcpy(cmdline + len, argv[i], n);
+        len += n;
+    }
+    strcpy(cmdline + len, cmd->bg ? " &\n" : "\n");
+
+    if(argv[0] == NULL || argv[0][0] == '\0'){
+        return;
+    }
+    runargv(argv, cmd->bg, cmdline, redirs, cmd->nredirs);
+}
+
+/* runscript - Interpret the instructions of a compiled script */
+void runscript(struct script_t *s){
+    struct insn_t *insn;
+    struct sloop_t *loop;
+    int *next; /* next word of each for loop */
+    int pc = 0;
+
+    if((next = calloc(s->nloops + 1, sizeof(int))) == NULL)
+        unix_error("calloc error");
+
+    while(pc < s->ncode){
+        insn = &s->code[pc++];
+        switch(insn->op){
+            case OP_RUN:
+                runcmd(s, &s->cmds[insn->a]);
+                flushout();
+                break;
+            case OP_JFALSE:
+                if(last_status != 0)
+                    pc = insn->b;
+                break;
+            case OP_JUMP:
+                pc = insn->b;
+                break;
+            case OP_FORINIT:
+                next[insn->a] = 0;
+                break;
+            case OP_FORNEXT:
+                loop = &s->loops[insn->a];
+                if(next[insn->a] == loop->nwords
+                   || expandword(s, &s->words[loop->word + next[insn->a]++],
+                                 vars[loop->var].value, MAXLINE) < 0)
+                    pc = insn->b;
+                break;
+        }
+    }
+
+    free(next);
+}
+/****************************
+ * end script helper routines
+ ****************************/
+
+
+/*********************************
+ * Helper routines for redirection
+ *********************************/
+
+/*
+ * readheredoc - Read lines from fp into buf until a line that is just
+ *    delim (or EOF). Return the length of the body, or -1 if it doesn't
+ *    fit in size bytes.
+ */
+int readheredoc(FILE *fp, const char *delim, char *buf, int size){
+    char line[MAXLINE];
+    int n, len = 0;
+
+    buf[0] = '\0';
+    while(fgets(line, MAXLINE, fp) != NULL){
+        n = strcspn(line, "\n");
+        if(n == strlen(delim) && strncmp(line, delim, n) == 0)
+            break;
+        n = strlen(line);
+        if(len + n >= size)
+            return -1;
+        memcpy(buf + len, line, n + 1);
+        len += n;
+    }
+    return len;
+}
+
+/*
+ * parseredirs - Take the redirection operators and their targets out of
+ *    argv and describe them in redirs, in order:
+ *        [n]< path   [n]> path   [n]>> path   [n]>&m   [n]<<< text
+ *        [n]<< delim  (here-document, read from fp into heredoc)
+ *    The target may be attached or the next word. A word parseline
+ *    found in quotes is never an operator. Return the number of
+ *    redirections, or -1 after printing an error.
+ */
+int parseredirs(char **argv, const char *quoted, struct redir_t *redirs, FILE *fp, char *heredoc){
+    struct redir_t *r;
+    char *p, *end;
+    int i, j, n = 0;
+
+    for (i = j = 0; argv[i] != NULL; i++) {
+	p = argv[i];
+	if (isdigit((unsigned char)p[0]) && (p[1] == '<' || p[1] == '>'))
+	    p++;
+	if (quoted[i] || (*p != '<' && *p != '>')) {
+	    argv[j++] = argv[i];
+	    continue;
+	}
+	if (n == MAXREDIRS) {
+	    printf("%s: too many redirections\n", argv[0]);
+	    return -1;
+	}
+
+	r = &redirs[n++];
+	r->fd = (p != argv[i]) ? argv[i][0] - '0' : (*p == '<') ? 0 : 1;
+	r->newline = 0;
+	if (strncmp(p, "<<<", 3) == 0) {
+	    r->op = R_HERE;
+	    r->newline = 1;
+	    p += 3;
+	}
+	else if (strncmp(p, "<<", 2) == 0) {
+	    r->op = R_HERE;
+	    p += 2;
+	}
+	else if (strncmp(p, ">>", 2) == 0) {
+	    r->op = R_APPEND;
+	    p += 2;
+	}
+	else if (strncmp(p, ">&", 2) == 0 || strncmp(p, "<&", 2) == 0) {
+	    r->op = R_DUP;
+	    r->fd2 = strtol(p + 2, &end, 10);
+	    if (!isdigit((unsigned char)p[2]) || *end != '\0' || r->fd2 > 9) {
+		printf("%s: bad file descriptor: %s\n", argv[0], argv[i]);
+		return -1;
+	    }
+	    continue;
+	}
+	else {
+	    r->op = (*p == '<') ? R_IN : R_OUT;
+	    p++;
+	}
+
+	/* the target is the rest of the word or the next word */
+	if (*p == '\0' && (p = argv[++i]) == NULL) {
+	    printf("%s: redirection needs a target\n", argv[0]);
+	    return -1;
+	}
+	r->arg = p;
+
+	if (r->op == R_HERE && !r->newline) {
+	    if (fp == NULL || heredoc == NULL) {
+		printf("%s: here-document not allowed here\n", argv[0]);
+		return -1;
+	    }
+	    if (readheredoc(fp, p, heredoc, MAXHERE) < 0) {
+		printf("%s: here-document too large\n", argv[0]);
+		return -1;
+	    }
+	    r->arg = heredoc;
+	}
+    }
+    argv[j] = NULL;
+    return n;
+}
+
+/*
+ * feedpipe - Write text (and a newline) into an empty pipe without
+ *    blocking. The pipe is grown to fit if needed. If byref is set the
+ *    text is spliced in with vmsplice instead of copied with write; the
+ *    pipe then refers to the caller's pages, so this is only safe when
+ *    the caller is about to exec and never touches them again. Return
+ *    -1 if it can't be done.
+ */
+int feedpipe(int fd, const char *text, int newline, int byref){
+    struct iovec iov[2];
+    int len = strlen(text);
+    ssize_t n;
+
+    iov[0].iov_base = (void *)text;
+    iov[0].iov_len = len;
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = newline;
+
+#ifdef F_SETPIPE_SZ
+    /* the pipe must hold all of it since nobody reads until after exec */
+    if (len + newline > fcntl(fd, F_GETPIPE_SZ) && fcntl(fd, F_SETPIPE_SZ, len + newline) < 0)
+	return -1;
+#else
+    if (len + newline > 4096)
+	return -1;
+#endif
+
+    while (iov[0].iov_len + iov[1].iov_len > 0) {
+#ifdef __linux__
+	if (!byref || ((n = vmsplice(fd, iov, 2, 0)) < 0 && errno != EINTR))
+	    n = writev(fd, iov, 2);
+#else
+	n = writev(fd, iov, 2);
+#endif
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0)
+	    return -1;
+	if (n >= iov[0].iov_len) {
+	    n -= iov[0].iov_len;
+	    iov[0].iov_len = 0;
+	    iov[1].iov_len -= n;
+	}
+	else {
+	    iov[0].iov_base = (char *)iov[0].iov_base + n;
+	    iov[0].iov_len -= n;
+	}
+    }
+    return 0;
+}
+
+/*
+ * applyredirs - Point file descriptors where the redirections say, in
+ *    order. Files are opened close-on-exec and only the final descriptor
+ *    is inherited. forked is set in a child that is about to exec, which
+ *    lets here-documents be spliced rather than copied. Return -1 after
+ *    printing an error.
+ */
+int applyredirs(struct redir_t *redirs, int nredirs, int forked){
+    struct redir_t *r;
+    int i, fd, fds[2];
+
+    for (i = 0; i < nredirs; i++) {
+	r = &redirs[i];
+	switch (r->op) {
+	case R_IN:
+	    fd = open(r->arg, O_RDONLY | O_CLOEXEC);
+	    break;
+	case R_OUT:
+	    fd = open(r->arg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	    break;
+	case R_APPEND:
+	    fd = open(r->arg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+	    break;
+	case R_DUP:
+	    if (r->fd != r->fd2 && dup2(r->fd2, r->fd) < 0) {
+		printf("%d: %s\n", r->fd2, strerror(errno));
+		return -1;
+	    }
+	    continue;
+	default: /* R_HERE */
+	    if (pipe2(fds, O_CLOEXEC) < 0 || feedpipe(fds[1], r->arg, r->newline, forked) < 0) {
+		printf("here-document: %s\n", strerror(errno));
+		return -1;
+	    }
+	    close(fds[1]);
+	    fd = fds[0];
+	    break;
+	}
+
+	if (fd < 0) {
+	    printf("%s: %s\n", r->arg, strerror(errno));
+	    return -1;
+	}
+	if (fd == r->fd) {
+	    fcntl(fd, F_SETFD, 0);
+	}
+	else {
+	    if (dup2(fd, r->fd) < 0) {
+		printf("%d: %s\n", r->fd, strerror(errno));
+		return -1;
+	    }
+	    close(fd);
+	}
+    }
+    return 0;
+}
+/*********************************
+ * end redirection helper routines
+ *********************************/
+
+
+/*************************************
+ * Helper routines for resource limits
+ *************************************/
+
+/*
+ * parselimits - Apply n name=value settings to lim. Return -1 after
+ *    printing an error, in which case lim is left alone.
+ */
+int parselimits(char *cmd, char **settings, int n, struct limits_t *lim){
+    struct limits_t new = *lim;
+    unsigned long long v;
+    char *value, *end;
+    int i, j, len;
+
+    for (i = 0; i < n; i++) {
+	value = strchr(settings[i], '=') + 1;
+	len = value - 1 - settings[i];
+	for (j = 0; j < NLIMITS; j++)
+	    if (strncmp(settings[i], limitnames[j], len) == 0 && limitnames[j][len] == '\0')
+		break;
+	if (j == NLIMITS) {
+	    printf("%s: %.*s: unknown limit\n", cmd, len, settings[i]);
+	    return -1;
+	}
+
+	/* an empty value drops the limit */
+	if (*value == '\0') {
+	    new.set &= ~(1 << j);
+	    continue;
+	}
+	if (strcmp(value, "unlimited") == 0) {
+	    v = RLIM_INFINITY;
+	}
+	else {
+	    errno = 0;
+	    v = strtoull(value, &end, 10);
+	    switch (*end) {
+	    case 'k': v <<= 10; end++; break;
+	    case 'm': v <<= 20; end++; break;
+	    case 'g': v <<= 30; end++; break;
+	    }
+	    if (!isdigit((unsigned char)*value) || *end != '\0' || errno != 0) {
+		printf("%s: %s: invalid value\n", cmd, settings[i]);
+		return -1;
+	    }
+	}
+	new.set |= 1 << j;
+	new.rlim[j] = v;
+    }
+    *lim = new;
+    return 0;
+}
+
+/* fmtlimit - Format a limit value into buf and return buf */
+char *fmtlimit(rlim_t value, char *buf){
+    if (value == RLIM_INFINITY)
+	strcpy(buf, "unlimited");
+    else
+	sprintf(buf, "%llu", (unsigned long long)value);
+    return buf;
+}
+
+/*
+ * mkrlimit - Turn a limit value for limitres[i] into the soft and hard
+ *    limits to set. The hard limit is set too, so the job can't raise
+ *    it again. A cpu limit gets one more second of hard limit so the
+ *    job is sent SIGXCPU before it is killed.
+ */
+void mkrlimit(int i, rlim_t value, struct rlimit *rl){
+    rl->rlim_cur = rl->rlim_max = value;
+    if (limitres[i] == RLIMIT_CPU && value != RLIM_INFINITY)
+	rl->rlim_max = value + 1;
+}
+
+/*
+ * applylimits - Set the limits in lim on the calling process. Return
+ *    -1 after printing an error.
+ */
+int applylimits(struct limits_t *lim){
+    struct rlimit rl;
+    int i;
+
+    for (i = 0; i < NLIMITS; i++) {
+	if (!(lim->set & (1 << i)))
+	    continue;
+	mkrlimit(i, lim->rlim[i], &rl);
+	if (setrlimit(limitres[i], &rl) < 0) {
+	    printf("limit: %s: %s\n", limitnames[i], strerror(errno));
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+/*
+ * prlimitgroup - Set a limit on every process in process group pgid.
+ *    The group's members are found by walking /proc. Return -1 with
+ *    errno set if no process could be changed.
+ */
+int prlimitgroup(pid_t pgid, int resource, struct rlimit *rlim){
+    DIR *dir;
+    struct dirent *d;
+    pid_t pid;
+    int n = 0, err = ESRCH;
+
+    if ((dir = opendir("/proc")) == NULL)
+	return prlimit(pgid, resource, rlim, NULL);
+    while ((d = readdir(dir)) != NULL) {
+	if ((pid = atoi(d->d_name)) <= 0 || getpgid(pid) != pgid)
+	    continue;
+	if (prlimit(pid, resource, rlim, NULL) == 0)
+	    n++;
+	else
+	    err = errno;
+    }
+    closedir(dir);
+    if (n == 0) {
+	errno = err;
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * limitkill - Return the name of the limit that most likely killed a
+ *    job, given its wait status and resource usage, or NULL. A cpu
+ *    limit shows up as SIGXCPU, or SIGKILL once the time is used up.
+ *    Running out of address space makes allocations fail, which a
+ *    program usually dies of with SIGSEGV, SIGBUS or SIGABRT. The kernel
+ *    doesn't say why an allocation failed, so any of those in a job with
+ *    an as limit is reported as the limit; an unrelated crash in such a
+ *    job is labelled the same way.
+ */
+char *limitkill(struct job_t *job, int status, struct rusage *ru){
+    int i, sig = WTERMSIG(status);
+    rlim_t cpu = ru->ru_utime.tv_sec + ru->ru_stime.tv_sec
+	+ (ru->ru_utime.tv_usec + ru->ru_stime.tv_usec + 999999) / 1000000;
+
+    if (sig == SIGXCPU)
+	return "cpu";
+    for (i = 0; i < NLIMITS; i++) {
+	if (!(job->limits.set & (1 << i)) || job->limits.rlim[i] == RLIM_INFINITY)
+	    continue;
+	if (limitres[i] == RLIMIT_CPU && sig == SIGKILL && cpu >= job->limits.rlim[i])
+	    return limitnames[i];
+	if (limitres[i] == RLIMIT_AS && (sig == SIGSEGV || sig == SIGBUS || sig == SIGABRT))
+	    return limitnames[i];
+    }
+    return NULL;
+}
+/*************************************
+ * end resource limit helper routines
+ *************************************/
+
+
+
+/***********************************************
+ * Helper routines for the trace-event timeline
+ ***********************************************/
+
+/* traceclock - Microseconds on the monotonic clock, 0 if not tracing */
+long long traceclock(void){
+    struct timespec ts;
+
+    if (tracefd < 0)
+	return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* traceopen - Start writing the timeline to path */
+void traceopen(char *path){
+    if ((tracefd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0)
+	unix_error("trace file error");
+    tracepid = getpid();
+    tracestart = traceclock();
+    atexit(traceclose);
+    tracename(tracepid, 0, "tsh\n");
+}
+
+/*
+ * tracerecord - Add an event to the buffer, flushing it first if it is
+ *    full. Signals are blocked meanwhile since the handlers record
+ *    events too.
+ */
+void tracerecord(struct tevent_t *e){
+    sigset_t all, prev;
+
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, &prev);
+    if (ntrace == TRACEBUF)
+	traceflush();
+    if (tracefd >= 0)
+	tracebuf[ntrace++] = *e;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/* trace - Record an event at the current time */
+void trace(char ph, const char *name, pid_t tid, const char *argname, int arg){
+    struct tevent_t e;
+
+    if (tracefd < 0)
+	return;
+
+    e.ts = traceclock() - tracestart;
+    e.dur = 0;
+    e.ph = ph;
+    e.name = name;
+    e.tid = tid;
+    e.argname = argname;
+    e.arg = arg;
+    e.label[0] = '\0';
+    tracerecord(&e);
+}
+
+/* tracespan - Record an event that started at start and ends now */
+void tracespan(const char *name, long long start, pid_t tid, const char *argname, int arg){
+    struct tevent_t e;
+
+    if (tracefd < 0)
+	return;
+
+    e.ts = start - tracestart;
+    e.dur = traceclock() - start;
+    e.ph = 'X';
+    e.name = name;
+    e.tid = tid;
+    e.argname = argname;
+    e.arg = arg;
+    e.label[0] = '\0';
+    tracerecord(&e);
+}
+
+/* tracename - Name the track of a job's process after its command line */
+void tracename(pid_t tid, int jid, char *cmdline){
+    struct tevent_t e;
+    int n = strcspn(cmdline, "\n");
+
+    if (tracefd < 0)
+	return;
+
+    e.ts = 0;
+    e.dur = 0;
+    e.ph = 'M';
+    e.name = "thread_name";
+    e.tid = tid;
+    e.argname = NULL;
+    e.arg = 0;
+    if (jid > 0)
+	snprintf(e.label, sizeof(e.label), "[%d] %.*s", jid, n, cmdline);
+    else
+	snprintf(e.label, sizeof(e.label), "%.*s", n, cmdline);
+    tracerecord(&e);
+}
+
+/*
+ * tracestate - Record a job moving from its current state to state.
+ *    Each state is a slice on the job's track; UNDEF ends the last one.
+ */
+void tracestate(struct job_t *job, int state){
+    static const char *names[] = {"UNDEF", "FG", "BG", "ST"};
+
+    if (tracefd < 0 || job->state == state)
+	return;
+
+    if (job->state != UNDEF)
+	trace('E', names[job->state], job->pid, NULL, 0);
+    if (state != UNDEF)
+	trace('B', names[state], job->pid, NULL, 0);
+}
+
+/*
+ * traceflush - Write the buffered events out as one batch. If the file
+ *    can't be written, tracing is turned off and the events are dropped.
+ */
+void traceflush(void){
+    char out[16384];
+    char label[sizeof(tracebuf[0].label) * 6];
+    struct tevent_t *e;
+    int i, j, k, len = 0;
+
+    for (i = 0; i < ntrace; i++) {
+	e = &tracebuf[i];
+	if (len > sizeof(out) - 512) {
+	    if (write(tracefd, out, len) < 0)
+		break;
+	    len = 0;
+	}
+
+	len += snprintf(out + len, sizeof(out) - len,
+			"%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%d,\"tid\":%d",
+			tracewritten++ ? ",\n" : "[\n", e->name, e->ph, e->ts, tracepid, e->tid);
+	if (e->ph == 'X')
+	    len += snprintf(out + len, sizeof(out) - len, ",\"dur\":%lld", e->dur);
+	if (e->ph == 'i')
+	    len += snprintf(out + len, sizeof(out) - len, ",\"s\":\"t\"");
+	if (e->ph == 'M') {
+	    /* escape the command line for JSON */
+	    for (j = k = 0; e->label[j] != '\0'; j++) {
+		if (e->label[j] == '"' || e->label[j] == '\\')
+		    label[k++] = '\\';
+		if ((unsigned char)e->label[j] < ' ')
+		    k += sprintf(label + k, "\\u%04x", e->label[j]);
+		else
+		    label[k++] = e->label[j];
+	    }
+	    label[k] = '\0';
+	    len += snprintf(out + len, sizeof(out) - len, ",\"args\":{\"name\":\"%s\"}", label);
+	}
+	else if (e->argname != NULL)
+	    len += snprintf(out + len, sizeof(out) - len, ",\"args\":{\"%s\":%d}", e->argname, e->arg);
+	len += snprintf(out + len, sizeof(out) - len, "}");
+    }
+    if (i < ntrace || (len > 0 && write(tracefd, out, len) < 0)) {
+	printf("trace: %s\n", strerror(errno));
+	close(tracefd);
+	tracefd = -1;
+    }
+    ntrace = 0;
+}
+
+/*
+ * traceclose - Flush the timeline and finish the JSON array. Runs at
+ *    exit, so children that exit before exec'ing must not run it.
+ */
+void traceclose(void){
+    sigset_t all;
+    int i;
+
+    if (tracefd < 0 || getpid() != tracepid)
+	return;
+
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, NULL);
+
+    /* end the slices of jobs that are still around */
+    for (i = 0; i < MAXJOBS; i++)
+	if (jobs[i].pid != 0)
+	    tracestate(&jobs[i], UNDEF);
+    traceflush();
+    if (tracefd < 0)
+	return;
+    if (write(tracefd, tracewritten ? "\n]\n" : "[]\n", 3) < 0)
+	return;
+    close(tracefd);
+    tracefd = -1;
+}
+/*******************************
+ * end timeline helper routines
+ *******************************/
+
+
+/*****************************************
+ * Helper routines for the job status page
+ *****************************************/
+
+/*
+ * statopen - Create the job status page /tsh.<pid> in shared memory.
+ *    It is removed again when the shell exits.
+ */
+void statopen(void){
+    char name[32];
+    int fd;
+
+    statpid = getpid();
+    sprintf(name, STAT_NAME, statpid);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+	unix_error("shm_open error");
+    if (ftruncate(fd, sizeof(struct stat_page_t)) < 0)
+	unix_error("ftruncate error");
+    statpage = mmap(NULL, sizeof(struct stat_page_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (statpage == MAP_FAILED)
+	unix_error("mmap error");
+    close(fd);
+
+    statpage->version = STAT_VERSION;
+    statpage->shellpid = statpid;
+    __atomic_store_n(&statpage->magic, STAT_MAGIC, __ATOMIC_RELEASE);
+    atexit(statclose);
+}
+
+/*
+ * statjob - Copy a job into its slot on the status page. The sequence
+ *    count is odd while the slot is being written, so readers retry
+ *    instead of seeing half an update. Only sigchld_handler and code
+ *    running with SIGCHLD blocked change jobs, so writes never nest.
+ */
+void statjob(struct job_t *job){
+    struct stat_job_t *s;
+    uint32_t seq;
+    int i;
+
+    if (statpage == NULL)
+	return;
+    s = &statpage->jobs[job - jobs];
+    seq = statpage->seq;
+    __atomic_store_n(&statpage->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    s->jid = job->jid;
+    s->pid = job->pid;
+    s->state = job->state;
+    s->restarts = job->restarts;
+    s->started = job->started.tv_sec * 1000000000LL + job->started.tv_nsec;
+    s->cpu = job->cpu;
+    for (i = 0; i < STAT_CMDLEN - 1 && job->cmdline[i] != '\0' && job->cmdline[i] != '\n'; i++)
+	s->cmdline[i] = job->cmdline[i];
+    s->cmdline[i] = '\0';
+
+    __atomic_store_n(&statpage->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* statclose - Remove the status page when the shell exits */
+void statclose(void){
+    char name[32];
+
+    /* children that fail to exec exit through here too */
+    if (getpid() != statpid)
+	return;
+    sprintf(name, STAT_NAME, statpid);
+    shm_unlink(name);
+}
+/**************************************
+ * end job status page helper routines
+ **************************************/
+
+
 /***********************
  * Other helper routines
  ***********************/
@@ -696,13 +3017,35 @@ void listjobs(struct job_t *jobs){
  * usage - print a help message
  */
 void usage(void){
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpRS] [-T <file>]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -R   keep each job until its whole process tree has exited\n");
+    printf("   -S   publish the job list in shared memory as /tsh.<pid>\n");
+    printf("   -T <file>  write a Chrome trace-event timeline of every job\n");
     exit(1);
 }
 
+/*
+ * flushout - Flush stdout with SIGCHLD blocked. A job message the
+ *    handler printed while fflush was writing the buffer out would be
+ *    thrown away when fflush empties it.
+ */
+void flushout(void){
+    sigset_t mask, prev;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if(sigprocmask(SIG_BLOCK, &mask, &prev) < 0){
+        unix_error("sigprocmask error (flushout)");
+    }
+    fflush(stdout);
+    if(sigprocmask(SIG_SETMASK, &prev, NULL) < 0){
+        unix_error("sigprocmask error (flushout)");
+    }
+}
+
 /*
  * unix_error - unix-style error routine
  */
@@ -719,6 +3062,32 @@ void app_error(char *msg){
     exit(1);
 }
 
+/*
+ * signum - Map a signal name (KILL, SIGKILL) or number to a signal
+ *    number. Return -1 if it isn't a signal.
+ */
+int signum(const char *name){
+    static const struct { const char *name; int sig; } sigs[] = {
+	{"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+	{"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+	{"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+	{"TTOU", SIGTTOU}, {"WINCH", SIGWINCH}
+    };
+    char *end;
+    int i, sig;
+
+    if (isdigit((unsigned char)name[0])) {
+	sig = strtol(name, &end, 10);
+	return (*end == '\0' && sig < NSIG) ? sig : -1;
+    }
+    if (strncmp(name, "SIG", 3) == 0)
+	name += 3;
+    for (i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+	if (strcmp(name, sigs[i].name) == 0)
+	    return sigs[i].sig;
+    return -1;
+}
+
 /*
  * Signal - wrapper for the sigaction function
  */
@@ -0,0 +1,471 @@
+/*
+ * tshbench.c - Benchmarks for the tiny shell
+ *
+ * usage: tshbench [-h] [-n <jobs>] [-i <iters>] [-s <shell>] [-f csv|json]
+ *
+ * Drives a shell through a pair of pipes, the way sdriver.pl does, and
+ * measures how fast it starts, waits for, reaps and signals jobs:
+ *
+ *     spawn        <iters> fg /bin/true commands back to back
+ *     fg_rtt       round trip of one fg command, from write to output
+ *     bg_fanout    <jobs> bg jobs that all exit together, then the reap
+ *     sigchld      <jobs> bg jobs that exit at once, checking for jobs
+ *                  left in the job list after they are gone (lost reaps)
+ *     sigint       ctrl-c forwarding to a fg job
+ *     sigtstp      ctrl-z forwarding to a fg job
+ *     jobs_list    the jobs builtin with <jobs> jobs in the list
+ *
+ * Results are printed one per line as CSV (bench,metric,value,unit)
+ * or as a JSON array so they can be compared between releases.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXLINE  1024    /* max line size */
+#define MAXBUF  65536    /* shell output buffer */
+#define MAXJOBS   256    /* size of tsh's job list */
+
+struct shell_t {         /* a shell under test */
+    pid_t pid;           /* shell process */
+    int in;              /* write end of the shell's stdin */
+    int out;             /* read end of the shell's stdout */
+    char buf[MAXBUF];    /* output not consumed yet */
+    size_t len;
+};
+
+int json = 0;            /* print results as JSON */
+int nresults = 0;        /* results printed so far */
+
+/*
+ * now_us - Microseconds on the monotonic clock
+ */
+double now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * report - Print one result
+ */
+void report(const char *bench, const char *metric, double value, const char *unit)
+{
+    if (json)
+	printf("%s\n  {\"bench\": \"%s\", \"metric\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}",
+	       nresults ? "," : "[", bench, metric, value, unit);
+    else
+	printf("%s,%s,%.3f,%s\n", bench, metric, value, unit);
+    nresults++;
+    fflush(stdout);
+}
+
+/*
+ * shell_open - Start the shell without a prompt
+ */
+void shell_open(struct shell_t *sh, char *prog)
+{
+    int tochild[2], fromchild[2];
+    char *argv[] = { prog, "-p", NULL };
+
+    if (pipe(tochild) < 0 || pipe(fromchild) < 0) {
+	perror("pipe");
+	exit(2);
+    }
+    if ((sh->pid = fork()) < 0) {
+	perror("fork");
+	exit(2);
+    }
+    if (sh->pid == 0) {
+	setpgid(0, 0);
+	dup2(tochild[0], 0);
+	dup2(fromchild[1], 1);
+	close(tochild[0]); close(tochild[1]);
+	close(fromchild[0]); close(fromchild[1]);
+	execv(prog, argv);
+	fprintf(stderr, "tshbench: exec of %s failed: %s\n", prog, strerror(errno));
+	exit(2);
+    }
+    close(tochild[0]);
+    close(fromchild[1]);
+    sh->in = tochild[1];
+    sh->out = fromchild[0];
+    sh->len = 0;
+}
+
+/*
+ * shell_send - Write a printf style command to the shell
+ */
+void shell_send(struct shell_t *sh, const char *fmt, ...)
+{
+    char line[MAXLINE];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (write(sh->in, line, n) != n) {
+	fprintf(stderr, "tshbench: shell stopped reading\n");
+	exit(2);
+    }
+}
+
+/*
+ * shell_close - Kill the shell's jobs, send it EOF and reap it
+ */
+void shell_close(struct shell_t *sh)
+{
+    shell_send(sh, "kill -KILL %%all\n");
+    close(sh->in);
+    waitpid(sh->pid, NULL, 0);
+    close(sh->out);
+}
+
+/*
+ * shell_line - Return the next line of shell output without its
+ *     newline, waiting up to ms milliseconds. Return NULL on timeout.
+ *     The line stays valid until the next call.
+ */
+char *shell_line(struct shell_t *sh, int ms)
+{
+    static char line[MAXLINE];
+    double deadline = now_us() + ms * 1000.0;
+    struct pollfd pfd;
+    char *nl;
+    int n, wait;
+
+    for (;;) {
+	if ((nl = memchr(sh->buf, '\n', sh->len)) != NULL) {
+	    n = nl - sh->buf;
+	    if (n >= MAXLINE)
+		n = MAXLINE - 1;
+	    memcpy(line, sh->buf, n);
+	    line[n] = '\0';
+	    sh->len -= nl - sh->buf + 1;
+	    memmove(sh->buf, nl + 1, sh->len);
+	    return line;
+	}
+	if ((wait = (deadline - now_us()) / 1000) <= 0)
+	    return NULL;
+	pfd.fd = sh->out;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, wait) <= 0)
+	    continue;
+	if ((n = read(sh->out, sh->buf + sh->len, MAXBUF - sh->len)) <= 0) {
+	    fprintf(stderr, "tshbench: shell exited\n");
+	    exit(2);
+	}
+	sh->len += n;
+    }
+}
+
+/*
+ * shell_expect - Skip output until count lines containing text have
+ *     been seen. Return 0, or -1 if that takes longer than ms.
+ */
+int shell_expect(struct shell_t *sh, const char *text, int count, int ms)
+{
+    double deadline = now_us() + ms * 1000.0;
+    char *line;
+    int left;
+
+    while (count > 0) {
+	if ((left = (deadline - now_us()) / 1000) <= 0
+	    || (line = shell_line(sh, left)) == NULL) {
+	    fprintf(stderr, "tshbench: timed out waiting for \"%s\"\n", text);
+	    return -1;
+	}
+	if (strstr(line, text) != NULL)
+	    count--;
+    }
+    return 0;
+}
+
+/*
+ * shell_countjobs - Run the jobs builtin and return how many jobs it
+ *     listed, or -1 on timeout. fg without arguments marks the end of
+ *     the listing; it is a builtin, so no process is started for it.
+ */
+int shell_countjobs(struct shell_t *sh)
+{
+    char *line;
+    int n = 0;
+
+    shell_send(sh, "jobs\nfg\n");
+    while ((line = shell_line(sh, 5000)) != NULL) {
+	if (strncmp(line, "fg command requires", 19) == 0)
+	    return n;
+	if (line[0] == '[' && strstr(line, ") Running ") != NULL)
+	    n++;
+	else if (line[0] == '[' && strstr(line, ") Stopped ") != NULL)
+	    n++;
+    }
+    return -1;
+}
+
+int cmpdouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * report_latency - Report mean, median, p99 and max of n samples (us)
+ */
+void report_latency(const char *bench, double *us, int n)
+{
+    double sum = 0;
+    int i;
+
+    if (n == 0)
+	return;
+    qsort(us, n, sizeof(double), cmpdouble);
+    for (i = 0; i < n; i++)
+	sum += us[i];
+    report(bench, "mean", sum / n, "us");
+    report(bench, "p50", us[n / 2], "us");
+    report(bench, "p99", us[(n * 99) / 100], "us");
+    report(bench, "max", us[n - 1], "us");
+}
+
+/* bench_spawn - Throughput of back to back fg jobs */
+void bench_spawn(char *prog, int iters)
+{
+    struct shell_t sh;
+    double t;
+    int i;
+
+    shell_open(&sh, prog);
+    t = now_us();
+    for (i = 0; i < iters; i++)
+	shell_send(&sh, "/bin/true\n");
+    shell_send(&sh, "/bin/echo __done__\n");
+    if (shell_expect(&sh, "__done__", 1, 60000) == 0) {
+	t = now_us() - t;
+	report("spawn", "jobs", iters + 1, "count");
+	report("spawn", "total", t / 1000, "ms");
+	report("spawn", "rate", (iters + 1) / (t / 1e6), "jobs/s");
+    }
+    shell_close(&sh);
+}
+
+/* bench_fg_rtt - Latency of one fg command from write to output */
+void bench_fg_rtt(char *prog, int iters)
+{
+    struct shell_t sh;
+    double *us = calloc(iters, sizeof(double)), t;
+    int i, n = 0;
+
+    shell_open(&sh, prog);
+    for (i = 0; i < iters; i++) {
+	t = now_us();
+	shell_send(&sh, "/bin/echo __rtt__\n");
+	if (shell_expect(&sh, "__rtt__", 1, 5000) < 0)
+	    break;
+	us[n++] = now_us() - t;
+    }
+    report_latency("fg_rtt", us, n);
+    shell_close(&sh);
+    free(us);
+}
+
+/* bench_bg_fanout - Launch njobs bg jobs that exit together, time the reap */
+void bench_bg_fanout(char *prog, int njobs)
+{
+    struct shell_t sh;
+    double start, launched, gone;
+    int i, left = njobs;
+
+    shell_open(&sh, prog);
+    start = now_us();
+    for (i = 0; i < njobs; i++)
+	shell_send(&sh, "/bin/sleep 0.5 &\n");
+    if (shell_expect(&sh, "/bin/sleep 0.5 &", njobs, 10000) < 0) {
+	shell_close(&sh);
+	return;
+    }
+    launched = now_us();
+
+    /* report the jobs that really made it into the list */
+    if ((njobs = shell_countjobs(&sh)) < 0) {
+	shell_close(&sh);
+	return;
+    }
+
+    /* the jobs exit 500ms after the first one started */
+    usleep(400000);
+    while (now_us() - launched < 3e6 && (left = shell_countjobs(&sh)) > 0)
+	usleep(1000);
+    gone = now_us();
+
+    report("bg_fanout", "jobs", njobs, "count");
+    report("bg_fanout", "launch", (launched - start) / 1000, "ms");
+    report("bg_fanout", "launch_per_job", (launched - start) / njobs, "us");
+    report("bg_fanout", "reap", (gone - start) / 1000 - 500, "ms");
+    report("bg_fanout", "unreaped", left < 0 ? njobs : left, "count");
+    shell_close(&sh);
+}
+
+/* bench_sigchld - Rounds of njobs jobs that exit at once, counting lost reaps */
+void bench_sigchld(char *prog, int njobs, int rounds)
+{
+    struct shell_t sh;
+    double t, total = 0;
+    int r, i, left, lost = 0;
+
+    shell_open(&sh, prog);
+    for (r = 0; r < rounds; r++) {
+	t = now_us();
+	for (i = 0; i < njobs; i++)
+	    shell_send(&sh, "/bin/true &\n");
+	shell_send(&sh, "/bin/echo __round__\n");
+	if (shell_expect(&sh, "__round__", 1, 10000) < 0)
+	    break;
+	total += now_us() - t;
+
+	/* every job has exited by now; anything still listed was lost */
+	usleep(100000);
+	if ((left = shell_countjobs(&sh)) < 0)
+	    break;
+	lost += left;
+	if (left > 0)
+	    shell_send(&sh, "kill -KILL %%all\ndisown %%all\n");
+    }
+    report("sigchld", "rounds", r, "count");
+    report("sigchld", "jobs_per_round", njobs, "count");
+    report("sigchld", "round", r ? total / r / 1000 : 0, "ms");
+    report("sigchld", "lost_reaps", lost, "count");
+    shell_close(&sh);
+}
+
+/* bench_signal - Latency of forwarding sig to a fg job */
+void bench_signal(char *prog, const char *bench, int sig, const char *msg, int rounds)
+{
+    struct shell_t sh;
+    double *us = calloc(rounds, sizeof(double)), t;
+    int r, left, n = 0;
+
+    shell_open(&sh, prog);
+    for (r = 0; r < rounds; r++) {
+	shell_send(&sh, "./myspin 10\n");
+	usleep(20000); /* let the job start */
+	t = now_us();
+	kill(sh.pid, sig);
+	if (shell_expect(&sh, msg, 1, 5000) < 0)
+	    break;
+	us[n++] = now_us() - t;
+
+	/* clean up a stopped job before the next round */
+	if (sig == SIGTSTP) {
+	    shell_send(&sh, "kill -KILL %%all\n");
+	    while ((left = shell_countjobs(&sh)) > 0)
+		usleep(1000);
+	    if (left < 0)
+		break;
+	}
+    }
+    report_latency(bench, us, n);
+    shell_close(&sh);
+    free(us);
+}
+
+/*
+ * bench_jobs_list - Time the jobs builtin with njobs jobs in the list.
+ *     Each sample waits for the known number of job lines, so nothing
+ *     but the builtin is timed.
+ */
+void bench_jobs_list(char *prog, int njobs, int iters)
+{
+    struct shell_t sh;
+    double *us = calloc(iters, sizeof(double)), t;
+    int i, n = 0;
+
+    shell_open(&sh, prog);
+    for (i = 0; i < njobs; i++)
+	shell_send(&sh, "./myspin 30 &\n");
+    if (shell_expect(&sh, "./myspin 30 &", njobs, 10000) == 0
+	&& (njobs = shell_countjobs(&sh)) > 0) {
+	for (i = 0; i < iters; i++) {
+	    t = now_us();
+	    shell_send(&sh, "jobs\n");
+	    if (shell_expect(&sh, ") Running ./myspin 30 &", njobs, 5000) < 0)
+		break;
+	    us[n++] = now_us() - t;
+	}
+    }
+    report("jobs_list", "jobs", njobs, "count");
+    report_latency("jobs_list", us, n);
+    shell_close(&sh);
+    free(us);
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: tshbench [-h] [-n <jobs>] [-i <iters>] [-s <shell>] [-f csv|json]\n");
+    fprintf(stderr, "   -h          print this message\n");
+    fprintf(stderr, "   -n <jobs>   jobs per fan-out, at most %d (default 16)\n", MAXJOBS);
+    fprintf(stderr, "   -i <iters>  iterations per benchmark (default 200)\n");
+    fprintf(stderr, "   -s <shell>  shell program to test (default ./tsh)\n");
+    fprintf(stderr, "   -f <fmt>    output format, csv (default) or json\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    char *prog = "./tsh";
+    int c, njobs = 16, iters = 200;
+
+    while ((c = getopt(argc, argv, "hn:i:s:f:")) != -1) {
+	switch (c) {
+	case 'n':
+	    if ((njobs = atoi(optarg)) < 1 || njobs > MAXJOBS)
+		usage();
+	    break;
+	case 'i':
+	    if ((iters = atoi(optarg)) < 10)
+		usage();
+	    break;
+	case 's':
+	    prog = optarg;
+	    break;
+	case 'f':
+	    if (strcmp(optarg, "json") == 0)
+		json = 1;
+	    else if (strcmp(optarg, "csv") != 0)
+		usage();
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (access(prog, X_OK) < 0) {
+	fprintf(stderr, "tshbench: %s is not executable\n", prog);
+	exit(2);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!json)
+	printf("bench,metric,value,unit\n");
+    bench_spawn(prog, iters);
+    bench_fg_rtt(prog, iters);
+    bench_bg_fanout(prog, njobs);
+    bench_sigchld(prog, njobs, iters / 10);
+    bench_signal(prog, "sigint", SIGINT, "terminated by signal 2", iters / 10);
+    bench_signal(prog, "sigtstp", SIGTSTP, "stopped by signal 20", iters / 10);
+    bench_jobs_list(prog, njobs, iters);
+    if (json)
+	printf("\n]\n");
+    exit(0);
+}
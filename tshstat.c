@@ -0,0 +1,225 @@
+/*
+ * tshstat.c - Show the jobs of running tiny shells
+ *
+ * usage: tshstat [-h] [-i <ms>] [pid...]
+ *
+ * Reads the job status page that tsh -S publishes in shared memory
+ * (see tshstat.h) for each shell PID given, or for every /dev/shm/tsh.*
+ * when none are. Snapshots are taken with the page's sequence lock, so
+ * the shells are never blocked, signalled or asked for anything. A
+ * job's CPU time is what its exited processes used plus what its live
+ * process and that process's reaped children have used so far, read
+ * from /proc. With -i the listing is repeated every <ms> milliseconds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tshstat.h"
+
+#define MAXSHELLS 1024  /* max shells shown at once */
+#define MAXTRIES  1000  /* snapshot attempts before giving up on a page */
+
+/*
+ * snapshot - Copy a consistent view of page into copy. Return -1 if
+ *     the shell kept writing for MAXTRIES attempts.
+ */
+int snapshot(struct stat_page_t *page, struct stat_page_t *copy)
+{
+    uint32_t seq;
+    int i;
+
+    for (i = 0; i < MAXTRIES; i++) {
+	seq = __atomic_load_n(&page->seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+	    continue;
+	memcpy(copy, page, sizeof(*copy));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&page->seq, __ATOMIC_RELAXED) == seq)
+	    return 0;
+    }
+    return -1;
+}
+
+/*
+ * livecpu - CPU microseconds used so far by process pid and the
+ *     children it has reaped, or 0 if it is gone
+ */
+long long livecpu(pid_t pid)
+{
+    char path[64], buf[1024], *p;
+    unsigned long long t[4];
+    long hz = sysconf(_SC_CLK_TCK);
+    int fd, n;
+
+    sprintf(path, "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY)) < 0)
+	return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+	return 0;
+    buf[n] = '\0';
+
+    /* utime, stime, cutime and cstime are fields 14-17; skip past comm */
+    if ((p = strrchr(buf, ')')) == NULL
+	|| sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %llu %llu",
+		  &t[0], &t[1], &t[2], &t[3]) != 4)
+	return 0;
+    return (t[0] + t[1] + t[2] + t[3]) * 1000000LL / hz;
+}
+
+/*
+ * openpage - Map the status page of shell pid read-only. Return NULL
+ *     after printing why if it can't be used.
+ */
+struct stat_page_t *openpage(pid_t pid)
+{
+    struct stat_page_t *page;
+    struct stat st;
+    char name[32];
+    int fd;
+
+    sprintf(name, STAT_NAME, (int)pid);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+	fprintf(stderr, "tshstat: %d: %s\n", (int)pid, strerror(errno));
+	return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*page)) {
+	fprintf(stderr, "tshstat: %d: not a status page\n", (int)pid);
+	close(fd);
+	return NULL;
+    }
+    page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+	fprintf(stderr, "tshstat: %d: %s\n", (int)pid, strerror(errno));
+	return NULL;
+    }
+    if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STAT_MAGIC
+	|| page->version != STAT_VERSION) {
+	fprintf(stderr, "tshstat: %d: not a status page\n", (int)pid);
+	munmap(page, sizeof(*page));
+	return NULL;
+    }
+    return page;
+}
+
+/*
+ * findshells - Fill pids with every shell that has a page in /dev/shm
+ *     and return how many there are
+ */
+int findshells(pid_t *pids)
+{
+    DIR *dir;
+    struct dirent *d;
+    char *end;
+    long pid;
+    int n = 0;
+
+    if ((dir = opendir("/dev/shm")) == NULL)
+	return 0;
+    while ((d = readdir(dir)) != NULL && n < MAXSHELLS) {
+	if (strncmp(d->d_name, "tsh.", 4) != 0 || !isdigit((unsigned char)d->d_name[4]))
+	    continue;
+	pid = strtol(d->d_name + 4, &end, 10);
+	if (*end == '\0' && pid > 0)
+	    pids[n++] = pid;
+    }
+    closedir(dir);
+    return n;
+}
+
+/*
+ * show - Print the jobs on one snapshot
+ */
+void show(struct stat_page_t *s, struct timespec *now)
+{
+    static char *states[] = {"Undefined", "Foreground", "Running", "Stopped"};
+    struct stat_job_t *j;
+    double elapsed, cpu;
+    int i;
+
+    for (i = 0; i < STAT_JOBS; i++) {
+	j = &s->jobs[i];
+	if (j->jid == 0)
+	    continue;
+	elapsed = (now->tv_sec * 1000000000LL + now->tv_nsec - j->started) / 1e9;
+	cpu = (j->cpu + livecpu(j->pid)) / 1e6;
+	printf("%7d %4d %7d %-10s %9.2f %9.2f %s\n", s->shellpid, j->jid, j->pid,
+	       states[j->state >= 0 && j->state <= 3 ? j->state : 0],
+	       elapsed < 0 ? 0 : elapsed, cpu, j->cmdline);
+    }
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: tshstat [-h] [-i <ms>] [pid...]\n");
+    fprintf(stderr, "   -h          print this message\n");
+    fprintf(stderr, "   -i <ms>     repeat every <ms> milliseconds\n");
+    fprintf(stderr, "   pid...      shells to show (default every shell started with -S)\n");
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    static pid_t pids[MAXSHELLS];
+    static struct stat_page_t *pages[MAXSHELLS];
+    struct stat_page_t copy;
+    struct timespec now, wait;
+    int c, i, n = 0, interval = 0;
+
+    while ((c = getopt(argc, argv, "hi:")) != -1) {
+	switch (c) {
+	case 'i':
+	    if ((interval = atoi(optarg)) < 1)
+		usage();
+	    break;
+	default:
+	    usage();
+	}
+    }
+    for (i = optind; i < argc && n < MAXSHELLS; i++)
+	if ((pids[n++] = atoi(argv[i])) <= 0)
+	    usage();
+    if (n == 0)
+	n = findshells(pids);
+
+    for (i = 0; i < n; i++) {
+	/* a shell that was killed can leave its page behind */
+	if (kill(pids[i], 0) < 0 && errno == ESRCH)
+	    fprintf(stderr, "tshstat: %d: shell is gone\n", (int)pids[i]);
+	else
+	    pages[i] = openpage(pids[i]);
+    }
+
+    wait.tv_sec = interval / 1000;
+    wait.tv_nsec = (interval % 1000) * 1000000L;
+    for (;;) {
+	printf("  SHELL  JID     PID STATE        ELAPSED       CPU COMMAND\n");
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < n; i++) {
+	    if (pages[i] == NULL)
+		continue;
+	    if (snapshot(pages[i], &copy) < 0)
+		fprintf(stderr, "tshstat: %d: page kept changing\n", (int)pids[i]);
+	    else
+		show(&copy, &now);
+	}
+	if (interval == 0)
+	    break;
+	printf("\n");
+	fflush(stdout);
+	nanosleep(&wait, NULL);
+    }
+    exit(0);
+}
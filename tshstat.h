@@ -0,0 +1,45 @@
+/*
+ * tshstat.h - Layout of the job status page a tiny shell started with
+ * -S publishes in POSIX shared memory as /tsh.<pid>
+ *
+ * The shell is the only writer and changes the page only when a job
+ * changes. Readers take a snapshot with the sequence lock:
+ *
+ *     do {
+ *         seq = page->seq (acquire); if odd, retry
+ *         copy the page
+ *         fence (acquire)
+ *     } while (page->seq != seq);
+ *
+ * so they never block the shell or make a system call into it.
+ */
+#ifndef TSHSTAT_H
+#define TSHSTAT_H
+
+#include <stdint.h>
+
+#define STAT_MAGIC   0x74736853 /* "tshS" */
+#define STAT_VERSION 1
+#define STAT_JOBS    256        /* slots, one per entry in the job list */
+#define STAT_CMDLEN  256        /* command lines are cut to this size */
+#define STAT_NAME    "/tsh.%d"  /* shm_open name, %d is the shell's PID */
+
+struct stat_job_t {             /* One job; jid is 0 if the slot is free */
+    int32_t jid;                /* job ID */
+    int32_t pid;                /* job PID, also its process group */
+    int32_t state;              /* 1 FG, 2 BG or 3 ST, as in tsh.c */
+    int32_t restarts;           /* supervise restarts so far */
+    int64_t started;            /* CLOCK_MONOTONIC ns when the process started */
+    int64_t cpu;                /* CPU us of the job's processes that have exited */
+    char cmdline[STAT_CMDLEN];  /* command line, NUL terminated */
+};
+
+struct stat_page_t {            /* The whole page */
+    uint32_t magic;             /* STAT_MAGIC once the page is set up */
+    uint32_t version;           /* STAT_VERSION */
+    int32_t shellpid;           /* PID of the shell */
+    uint32_t seq;               /* odd while the shell is writing */
+    struct stat_job_t jobs[STAT_JOBS];
+};
+
+#endif /* TSHSTAT_H */